@@ -24,6 +24,9 @@
 
 #include <Arduino.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#include "pc80hal.h"
 
 #ifdef DEBUG_PC80
 // #define DEBUG_D88
@@ -40,24 +43,46 @@
 PC80D88::PC80D88() {
     mType = DISK_TYPE_UNKNOWN;
     mFP = nullptr;
+    strcpy(mFileName, "");
+    mOverlay = false;
+    mOverlayFP = nullptr;
+    strcpy(mOverlayName, "");
+    mImage = nullptr;
+    mMutex = xSemaphoreCreateMutex();
+    mReadAheadMutex = xSemaphoreCreateMutex();
+    mReadAheadFP = nullptr;
+    mGeneration = 0;
+    mWriter = nullptr;
     mHeader = nullptr;
     mTrack = nullptr;
     mWriteProtect = false;
 
     mDiskSize = 0;
     mMaxTrack = 0;
+
+    mReadAheadHits = 0;
+    mReadAheadMisses = 0;
 }
 
 PC80D88::~PC80D88() {}
 
-int PC80D88::open(const char* fileName) {
+// cache: read the whole image into PSRAM instead of loading tracks on first access.
+// overlay: open the image read-only and keep writes in <name>.OVL next to it.
+int PC80D88::open(const char* fileName, bool cache, bool overlay) {
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    auto rc = load(fileName, cache, overlay);
+    xSemaphoreGive(mMutex);
+    return rc;
+}
+
+int PC80D88::load(const char* fileName, bool cache, bool overlay) {
     if (mFP != nullptr) {
-        close();
+        release();
     }
 
     const char* ext = strrchr(fileName, '.');
 
-    if (ext == nullptr) return -1;
+    if (ext == nullptr || strlen(fileName) >= sizeof(mFileName)) return -1;
 
     if (!strcasecmp(ext, ".D88")) {
         struct stat fileStat;
@@ -65,9 +90,9 @@ int PC80D88::open(const char* fileName) {
             return -1;
         }
 
-        mHeader = (d88_header_t*)ps_malloc(sizeof(d88_header_t));
+        mHeader = (d88_header_t*)PC80HAL::alloc(sizeof(d88_header_t));
 
-        mFP = fopen(fileName, "rb+");
+        mFP = fopen(fileName, overlay ? "rb" : "rb+");
         if (!mFP) {
 #ifdef DEBUG_D88
             Serial.printf("Open error: %s\n", fileName);
@@ -81,7 +106,7 @@ int PC80D88::open(const char* fileName) {
         size_t result = fread(mHeader, 1, sizeof(d88_header_t), mFP);
 
         if (result != sizeof(d88_header_t)) {
-            close();
+            release();
             return -1;
         }
 
@@ -92,7 +117,7 @@ int PC80D88::open(const char* fileName) {
 #ifdef DEBUG_D88
             Serial.printf("disk size error %d %d", mDiskSize, mHeader->diskSize);
 #endif
-            close();
+            release();
             return -1;
         }
 
@@ -101,7 +126,7 @@ int PC80D88::open(const char* fileName) {
 
         mWriteProtect = mHeader->writeProtect != 0x00;
 
-        if (mWriteProtect) {
+        if (mWriteProtect && !overlay) {
             fclose(mFP);
             mFP = fopen(fileName, "rb");
             if (!mFP) {
@@ -115,9 +140,9 @@ int PC80D88::open(const char* fileName) {
 #endif
         }
 
-        mTrack = (d88_track_t*)ps_malloc(sizeof(d88_track_t) * mMaxTrack);
+        mTrack = (d88_track_t*)PC80HAL::alloc(sizeof(d88_track_t) * mMaxTrack);
         if (mTrack == nullptr) {
-            close();
+            release();
             return -1;
         }
 
@@ -127,6 +152,11 @@ int PC80D88::open(const char* fileName) {
 
         for (int i = 0; i < mMaxTrack; i++) {
             mTrack[i].buff = nullptr;
+            mTrack[i].dirty = false;
+            mTrack[i].dirtySectors = 0;
+            mTrack[i].prefetched = false;
+            mTrack[i].index = nullptr;
+            mTrack[i].overlay = nullptr;
             if (mHeader->track[i] > 0) {
                 mTrack[i].offset = mHeader->track[i];
                 auto nextOffset = mHeader->diskSize;
@@ -145,6 +175,50 @@ int PC80D88::open(const char* fileName) {
             }
         }
 
+        strcpy(mFileName, fileName);
+        mOverlay = overlay;
+        if (overlay) {
+            strcpy(mOverlayName, fileName);
+            strcpy(mOverlayName + (ext - fileName), ".OVL");
+            if (exists(mOverlayName) && readOverlay() < 0) {
+#ifdef DEBUG_D88
+                Serial.printf("Overlay error: %s\n", mOverlayName);
+#endif
+                release();
+                return -1;
+            }
+        }
+
+        if (cache) {
+            auto image = (uint8_t*)PC80HAL::alloc(mDiskSize);
+            if (image != nullptr) {
+                fseek(mFP, 0, SEEK_SET);
+                bool ok = fread(image, 1, mDiskSize, mFP) == (size_t)mDiskSize;
+                for (int i = 0; ok && i < mMaxTrack; i++) {
+                    if (mTrack[i].offset > 0) {
+                        mTrack[i].buff = image + mTrack[i].offset;
+                        ok = applyOverlay(&mTrack[i]);
+                    }
+                }
+                if (ok) {
+                    mImage = image;
+                } else {
+                    for (int i = 0; i < mMaxTrack; i++) mTrack[i].buff = nullptr;
+                    free(image);  // fall back to loading tracks on first access
+                }
+            }
+#ifdef DEBUG_D88
+            Serial.printf("D88: image %s\n", mImage ? "cached" : "not cached");
+#endif
+        }
+
+        mGeneration++;
+        if (mImage == nullptr) {
+            xSemaphoreTake(mReadAheadMutex, portMAX_DELAY);
+            mReadAheadFP = fopen(fileName, "rb");  // without it tracks are only loaded on demand
+            xSemaphoreGive(mReadAheadMutex);
+        }
+
         mNextSector = 1;
         mType = DISK_TYPE_D88;
         return 0;
@@ -154,6 +228,25 @@ int PC80D88::open(const char* fileName) {
 }
 
 int PC80D88::close(void) {
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    release();
+    xSemaphoreGive(mMutex);
+    return 0;
+}
+
+// Writes back pending writes and frees everything; the caller holds mMutex.
+void PC80D88::release(void) {
+    mGeneration++;  // a read-ahead in progress must not publish into the freed tracks
+    if (mTrack != nullptr && mFP != nullptr) {
+        writeBack();
+    }
+    dropOverlay();
+    xSemaphoreTake(mReadAheadMutex, portMAX_DELAY);
+    if (mReadAheadFP != nullptr) {
+        fclose(mReadAheadFP);
+        mReadAheadFP = nullptr;
+    }
+    xSemaphoreGive(mReadAheadMutex);
     if (mFP != nullptr) {
         fclose(mFP);
         mFP = nullptr;
@@ -164,17 +257,323 @@ int PC80D88::close(void) {
     }
     if (mTrack != nullptr) {
         for (int i = 0; i < mMaxTrack; i++) {
-            if (mTrack[i].buff != nullptr) {
+            if (mTrack[i].buff != nullptr && mImage == nullptr) {
                 free(mTrack[i].buff);
-                mTrack[i].buff = nullptr;
+            }
+            mTrack[i].buff = nullptr;
+            if (mTrack[i].index != nullptr) {
+                free(mTrack[i].index);
+                mTrack[i].index = nullptr;
             }
         }
         free(mTrack);
         mTrack = nullptr;
     }
+    if (mImage != nullptr) {
+        free(mImage);
+        mImage = nullptr;
+    }
+}
+
+// Writes the dirty tracks back to the file, one track per lock.
+int PC80D88::flush(void) {
+    int rc = 0;
+    for (int i = 0;; i++) {
+        xSemaphoreTake(mMutex, portMAX_DELAY);
+        if (mTrack == nullptr || i >= mMaxTrack) {
+            xSemaphoreGive(mMutex);
+            break;
+        }
+        if ((mTrack[i].dirty || mTrack[i].dirtySectors) && writeTrack(i) < 0) rc = D88_IO_ERROR;
+        xSemaphoreGive(mMutex);
+    }
+    return rc;
+}
+
+// The caller holds mMutex.
+int PC80D88::writeBack(void) {
+    int rc = 0;
+    for (int i = 0; i < mMaxTrack; i++) {
+        if ((mTrack[i].dirty || mTrack[i].dirtySectors) && writeTrack(i) < 0) rc = D88_IO_ERROR;
+    }
+    return rc;
+}
+
+// Writes a formatted track whole, otherwise each run of adjacent dirty sectors with one fwrite.
+int PC80D88::writeTrack(int trackNo) {
+    auto track = &mTrack[trackNo];
+    int rc = 0;
+
+    if (track->dirty) {
+        rc = writeRange(trackNo, 0, track->size);
+    } else {
+        auto index = track->index;
+        auto dirty = track->dirtySectors;
+        for (int i = 0; i < index->count; i++) {
+            if (!((dirty >> i) & 1)) continue;
+            int last = i;
+            while (!mOverlay && last + 1 < index->count && ((dirty >> (last + 1)) & 1)) last++;  // overlay: one record per sector
+
+            uint32_t start = index->sector[i].offset + sizeof(d88_sector_header_t);
+            uint32_t end = index->sector[last].offset + sizeof(d88_sector_header_t) + index->sector[last].size;
+            if (writeRange(trackNo, start, end - start) < 0) rc = D88_IO_ERROR;
+            i = last;
+        }
+    }
+    auto fp = mOverlay ? mOverlayFP : mFP;
+    if (fp != nullptr) fflush(fp);
+    track->dirty = false;
+    track->dirtySectors = 0;
+
+#ifdef DEBUG_D88
+    if (rc < 0) Serial.printf("D88: write back error track %d\n", trackNo);
+#endif
+    return rc;
+}
+
+// Writes a range of a track buffer to the image, or to the overlay file in overlay mode.
+int PC80D88::writeRange(int trackNo, uint32_t offset, uint32_t size) {
+    if (mOverlay) {
+        return writeOverlay(trackNo, offset, size);
+    }
+    auto track = &mTrack[trackNo];
+    fseek(mFP, track->offset + offset, SEEK_SET);
+    return fwrite(track->buff + offset, 1, size, mFP) == size ? 0 : D88_IO_ERROR;
+}
+
+// Writes the overlay into the base image and deletes the overlay file.
+int PC80D88::commit(void) {
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    if (!mOverlay || mFP == nullptr) {
+        xSemaphoreGive(mMutex);
+        return 0;
+    }
+    if (mWriteProtect) {
+        xSemaphoreGive(mMutex);
+        return D88_WRITE_PROTECT;
+    }
+
+    int rc = writeBack();
+    if (rc == 0 && mOverlayFP != nullptr) {
+        auto fp = fopen(mFileName, "rb+");
+        if (fp == nullptr) {
+            rc = D88_IO_ERROR;
+        } else {
+            for (int i = 0; i < mMaxTrack; i++) {
+                auto track = &mTrack[i];
+                if (track->overlay == nullptr) continue;
+                if (loadTrack(track) == nullptr) {  // base track with the overlay applied
+                    rc = D88_IO_ERROR;
+                    continue;
+                }
+                fseek(fp, track->offset, SEEK_SET);
+                if (fwrite(track->buff, 1, track->size, fp) != track->size) rc = D88_IO_ERROR;
+            }
+            if (fclose(fp) != 0) rc = D88_IO_ERROR;
+        }
+        if (rc == 0) {
+            dropOverlay();
+            remove(mOverlayName);
+            fclose(mFP);  // drop what the read-only handle buffered of the old image
+            mFP = fopen(mFileName, "rb");
+            if (mFP == nullptr) rc = D88_IO_ERROR;
+        }
+    }
+    xSemaphoreGive(mMutex);
+#ifdef DEBUG_D88
+    Serial.printf("D88: commit %s %d\n", mOverlayName, rc);
+#endif
+    return rc;
+}
+
+// Deletes the overlay file, pending writes included, and reopens the base image as it is.
+int PC80D88::discard(void) {
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    if (!mOverlay || mFP == nullptr) {
+        xSemaphoreGive(mMutex);
+        return 0;
+    }
+    for (int i = 0; i < mMaxTrack; i++) {
+        mTrack[i].dirty = false;
+        mTrack[i].dirtySectors = 0;
+    }
+    dropOverlay();
+    remove(mOverlayName);
+
+    char fileName[sizeof(mFileName)];
+    strcpy(fileName, mFileName);
+    bool cache = mImage != nullptr;
+    release();
+    auto rc = load(fileName, cache, true);
+    xSemaphoreGive(mMutex);
+    return rc;
+}
+
+// Creates the overlay file on the first write back; the caller holds mMutex.
+int PC80D88::openOverlay(void) {
+    mOverlayFP = fopen(mOverlayName, "wb+");
+    if (mOverlayFP == nullptr) {
+        return D88_IO_ERROR;
+    }
+    d88_overlay_header_t header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, D88_OVERLAY_MAGIC);
+    header.diskSize = mDiskSize;
+    if (fwrite(&header, 1, sizeof(header), mOverlayFP) != sizeof(header)) {
+        fclose(mOverlayFP);
+        mOverlayFP = nullptr;
+        return D88_IO_ERROR;
+    }
+    return 0;
+}
+
+// Opens an existing overlay file and indexes its records by track.
+int PC80D88::readOverlay(void) {
+    mOverlayFP = fopen(mOverlayName, "rb+");
+    if (mOverlayFP == nullptr) {
+        return D88_IO_ERROR;
+    }
+    d88_overlay_header_t header;
+    if (fread(&header, 1, sizeof(header), mOverlayFP) != sizeof(header) || memcmp(header.magic, D88_OVERLAY_MAGIC, sizeof(header.magic)) ||
+        header.diskSize != mDiskSize) {
+        return D88_IO_ERROR;
+    }
+
+    fseek(mOverlayFP, 0, SEEK_END);
+    long end = ftell(mOverlayFP);
+    long position = sizeof(header);  // of the next record
+    d88_overlay_record_t record;
+    while (position + (long)sizeof(record) <= end) {
+        fseek(mOverlayFP, position, SEEK_SET);
+        if (fread(&record, 1, sizeof(record), mOverlayFP) != sizeof(record)) {
+            return D88_IO_ERROR;
+        }
+        if (position + (long)sizeof(record) + record.size > end) {
+            break;  // data cut short by an interrupted write back
+        }
+        if (record.track >= mMaxTrack || mTrack[record.track].offset == 0 || record.offset + record.size > mTrack[record.track].size) {
+            return D88_IO_ERROR;
+        }
+        if (!addOverlayEntry(&mTrack[record.track], record.offset, record.size, position + sizeof(record))) {
+            return D88_IO_ERROR;
+        }
+        position += sizeof(record) + record.size;
+    }
+
+    if (position < end) {  // drop the torn record, so that new records are appended where it began
+#ifdef DEBUG_D88
+        Serial.printf("D88: overlay truncated at %ld of %ld\n", position, end);
+#endif
+        fclose(mOverlayFP);
+        mOverlayFP = nullptr;
+        if (truncate(mOverlayName, position) != 0) {
+            return D88_IO_ERROR;
+        }
+        mOverlayFP = fopen(mOverlayName, "rb+");
+        if (mOverlayFP == nullptr) {
+            return D88_IO_ERROR;
+        }
+    }
     return 0;
 }
 
+// A range covering the whole track supersedes the earlier ones.
+bool PC80D88::addOverlayEntry(d88_track_t* track, uint32_t offset, uint32_t size, long position) {
+    auto overlay = track->overlay;
+    if (overlay == nullptr) {
+        overlay = (d88_overlay_t*)PC80HAL::alloc(sizeof(d88_overlay_t));
+        if (overlay == nullptr) {
+            return false;
+        }
+        overlay->count = 0;
+        track->overlay = overlay;
+    }
+    if (offset == 0 && size == track->size) {
+        overlay->count = 0;
+    }
+    if (overlay->count == D88_OVERLAY_ENTRIES) {
+        return false;
+    }
+    auto entry = &overlay->entry[overlay->count++];
+    entry->offset = offset;
+    entry->size = size;
+    entry->position = position;
+    return true;
+}
+
+// Copies the overlay ranges of a track over the data read from the base image.
+// false: the overlay could not be read and the track must not be used.
+bool PC80D88::applyOverlay(d88_track_t* track) {
+    auto overlay = track->overlay;
+    if (overlay == nullptr || mOverlayFP == nullptr) {
+        return true;
+    }
+    for (int i = 0; i < overlay->count; i++) {
+        auto entry = &overlay->entry[i];
+        fseek(mOverlayFP, entry->position, SEEK_SET);
+        if (fread(track->buff + entry->offset, 1, entry->size, mOverlayFP) != entry->size) {
+#ifdef DEBUG_D88
+            Serial.printf("D88: overlay read error %s\n", mOverlayName);
+#endif
+            return false;
+        }
+    }
+    return true;
+}
+
+// Rewrites a range already in the overlay file in place, otherwise appends a record; the caller holds mMutex.
+int PC80D88::writeOverlay(int trackNo, uint32_t offset, uint32_t size) {
+    auto track = &mTrack[trackNo];
+    if (size > 0xffff || (mOverlayFP == nullptr && openOverlay() < 0)) {
+        return D88_IO_ERROR;
+    }
+
+    bool whole = offset == 0 && size == track->size;
+    auto overlay = track->overlay;
+    if (overlay != nullptr && !whole) {  // a whole track is appended so that it supersedes the sectors written after it
+        for (int i = 0; i < overlay->count; i++) {
+            auto entry = &overlay->entry[i];
+            if (entry->offset == offset && entry->size == size) {
+                fseek(mOverlayFP, entry->position, SEEK_SET);
+                return fwrite(track->buff + offset, 1, size, mOverlayFP) == size ? 0 : D88_IO_ERROR;
+            }
+        }
+        if (overlay->count == D88_OVERLAY_ENTRIES) {
+            return writeOverlay(trackNo, 0, track->size);
+        }
+    }
+
+    d88_overlay_record_t record;
+    record.track = trackNo;
+    record.size = size;
+    record.offset = offset;
+    fseek(mOverlayFP, 0, SEEK_END);
+    if (fwrite(&record, 1, sizeof(record), mOverlayFP) != sizeof(record)) {
+        return D88_IO_ERROR;
+    }
+    auto position = ftell(mOverlayFP);
+    if (fwrite(track->buff + offset, 1, size, mOverlayFP) != size) {
+        return D88_IO_ERROR;
+    }
+    return addOverlayEntry(track, offset, size, position) ? 0 : D88_IO_ERROR;
+}
+
+// Closes the overlay file and forgets its index; the file itself is kept.
+void PC80D88::dropOverlay(void) {
+    if (mOverlayFP != nullptr) {
+        fclose(mOverlayFP);
+        mOverlayFP = nullptr;
+    }
+    if (mTrack != nullptr) {
+        for (int i = 0; i < mMaxTrack; i++) {
+            if (mTrack[i].overlay != nullptr) {
+                free(mTrack[i].overlay);
+                mTrack[i].overlay = nullptr;
+            }
+        }
+    }
+}
+
 int PC80D88::readData(uint8_t* dest, d88_io_parameter_t* ioParam) {
     auto trackNo = ioParam->cylinder * 2 + ioParam->HD;
     if (getTrackBuffer(trackNo) == nullptr) {
@@ -182,15 +581,10 @@ int PC80D88::readData(uint8_t* dest, d88_io_parameter_t* ioParam) {
     }
     auto track = &mTrack[trackNo];
 
-    auto buf = track->buff;
-    auto header = (d88_sector_header_t*)buf;
-    for (int i = 1; i <= header->numberOfSector; i++) {
-        header = (d88_sector_header_t*)buf;
-        if (memcmp(&header->geometry, &ioParam->C, 4) == 0) {
-            memcpy(dest, buf + sizeof(d88_sector_header_t), header->sizeOfData);
-            return header->sizeOfData;
-        }
-        buf += sizeof(d88_sector_header_t) + header->sizeOfData;
+    auto sector = findSector(track, &ioParam->C);
+    if (sector != nullptr) {
+        memcpy(dest, track->buff + sector->offset + sizeof(d88_sector_header_t), sector->size);
+        return sector->size;
     }
 #ifdef DEBUG_D88
     Serial.printf("D88: sector not found");
@@ -258,27 +652,21 @@ int PC80D88::readID(uint8_t* dest, d88_io_parameter_t* ioParam) {
     if (buf == nullptr) {
         return -1;
     }
-    auto header = (d88_sector_header_t*)buf;
-    auto numberOfSector = header->numberOfSector;
+    auto index = mTrack[trackNo].index;
 
-    if (mNextSector > numberOfSector) {
+    if (mNextSector > index->count) {
         mNextSector = 1;
     }
 #ifdef DEBUG_D88
     Serial.printf("Read id: %d\n", mNextSector);
 #endif
 
-    for (int i = 1; i <= numberOfSector; i++) {
-        if (mNextSector == i) {
-            memcpy(dest, &header->geometry, sizeof(d88_geometry_t));
-            mNextSector++;
-            return 4;
-        }
-
-        buf += sizeof(d88_sector_header_t) + header->sizeOfData;
-        header = (d88_sector_header_t*)buf;
+    if (mNextSector > index->count) {
+        return -1;
     }
-    return -1;
+    memcpy(dest, &index->sector[mNextSector - 1].geometry, sizeof(d88_geometry_t));
+    mNextSector++;
+    return 4;
 }
 
 int PC80D88::writeData(uint8_t* src, d88_io_parameter_t* ioParam) {
@@ -298,27 +686,18 @@ int PC80D88::writeData(uint8_t* src, d88_io_parameter_t* ioParam) {
     Serial.printf("PC80D88::writeData: offset %08x\n", track->offset);
 #endif
 
-    auto buff = track->buff;
-    auto header = (d88_sector_header_t*)buff;
-
-    for (int i = 1; i <= header->numberOfSector; i++) {
-        header = (d88_sector_header_t*)buff;
-        if (memcmp(&header->geometry, &ioParam->C, 4) == 0) {
+    auto sector = findSector(track, &ioParam->C);
+    if (sector != nullptr) {
 #ifdef DEBUG_D88
-            Serial.printf("write Data: %02x %02x %02x %02x %03x\n", ioParam->C, ioParam->H, ioParam->R, ioParam->N, header->sizeOfData);
+        Serial.printf("write Data: %02x %02x %02x %02x %03x\n", ioParam->C, ioParam->H, ioParam->R, ioParam->N, sector->size);
 #endif
-            memcpy(buff + sizeof(d88_sector_header_t), src, header->sizeOfData);
-            fseek(mFP, track->offset + buff + sizeof(d88_sector_header_t) - track->buff, SEEK_SET);
-            size_t result = fwrite(src, 1, header->sizeOfData, mFP);
-            if (result != header->sizeOfData) {
-                return D88_IO_ERROR;
-            }
-#ifdef DEBUG_D88
-            Serial.println("write data ok");
-#endif
-            return header->sizeOfData;
-        }
-        buff += sizeof(d88_sector_header_t) + header->sizeOfData;
+        // Acknowledged from memory; the writer task writes the sector back later.
+        xSemaphoreTake(mMutex, portMAX_DELAY);
+        memcpy(track->buff + sector->offset + sizeof(d88_sector_header_t), src, sector->size);
+        track->dirtySectors |= 1ULL << (sector - track->index->sector);
+        xSemaphoreGive(mMutex);
+        if (mWriter) xTaskNotifyGive(mWriter);
+        return sector->size;
     }
 #ifdef DEBUG_D88
     Serial.printf("D88: sector not found\n");
@@ -349,6 +728,11 @@ int PC80D88::writeID(d88_write_id_t* ioParam) {
 
     int offset = 0;
 
+    if ((sizeof(d88_sector_header_t) + sectorSize) * ioParam->SC > track->size) {
+        return D88_IO_ERROR;  // does not fit in the track of the image
+    }
+
+    xSemaphoreTake(mMutex, portMAX_DELAY);
     for (int i = 0; i < ioParam->SC; i++) {
 #ifdef DEBUG_D88
         Serial.printf("%02x %02x %02x %02x\n", ioParam->id[i].C, ioParam->id[i].H, ioParam->id[i].R, ioParam->id[i].N);
@@ -359,11 +743,10 @@ int PC80D88::writeID(d88_write_id_t* ioParam) {
         memset(buf + offset, ioParam->DataPattern, sectorSize);
         offset += sectorSize;
     }
-    fseek(mFP, track->offset, SEEK_SET);
-    size_t result = fwrite(buf, 1, offset, mFP);
-    if (result != offset) {
-        return D88_IO_ERROR;
-    }
+    indexTrack(track, track->index);
+    track->dirty = true;
+    xSemaphoreGive(mMutex);
+    if (mWriter) xTaskNotifyGive(mWriter);
 #ifdef DEBUG_D88
     Serial.printf("%08x %04x\n", track->offset, offset);
 #endif
@@ -371,27 +754,152 @@ int PC80D88::writeID(d88_write_id_t* ioParam) {
 }
 
 uint8_t* PC80D88::getTrackBuffer(int trackNo) {
+    if (mTrack == nullptr || trackNo < 0 || trackNo >= mMaxTrack || mTrack[trackNo].offset == 0) {
+        return nullptr;
+    }
     auto track = &mTrack[trackNo];
+    if (track->index != nullptr) {
+        if (track->prefetched) {
+            track->prefetched = false;
+            mReadAheadHits++;
+        }
+        return track->buff;
+    }
+
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    if (track->buff == nullptr) {
+        mReadAheadMisses++;
+    } else if (track->prefetched) {  // read-ahead finished while waiting for the lock
+        track->prefetched = false;
+        mReadAheadHits++;
+    }
+    auto buff = loadTrack(track);
+    xSemaphoreGive(mMutex);
+    return buff;
+}
+
+// Loads a track from the read-ahead task. The SD card is read through mReadAheadFP into a private
+// buffer without mMutex, so FDC commands only wait for the buffer to be published.
+void PC80D88::prefetch(int trackNo) {
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    if (mTrack == nullptr || mImage != nullptr || trackNo < 0 || trackNo >= mMaxTrack || mTrack[trackNo].offset == 0 ||
+        mTrack[trackNo].buff != nullptr) {
+        xSemaphoreGive(mMutex);
+        return;
+    }
+    uint32_t generation = mGeneration;
+    long offset = mTrack[trackNo].offset;
+    uint32_t size = mTrack[trackNo].size;
+    xSemaphoreGive(mMutex);
+
+    auto buff = (uint8_t*)PC80HAL::alloc(size);
+    if (buff == nullptr) {
+        return;
+    }
+    bool ok = false;
+    xSemaphoreTake(mReadAheadMutex, portMAX_DELAY);
+    if (mReadAheadFP != nullptr && generation == mGeneration) {
+        fseek(mReadAheadFP, offset, SEEK_SET);
+        ok = fread(buff, 1, size, mReadAheadFP) == size;
+    }
+    xSemaphoreGive(mReadAheadMutex);
+
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+    if (ok && generation == mGeneration && mTrack != nullptr && mTrack[trackNo].buff == nullptr) {  // the FDC may have loaded it meanwhile
+        auto track = &mTrack[trackNo];
+        track->buff = buff;
+        if (!applyOverlay(track)) {
+            track->buff = nullptr;
+            free(buff);
+        } else if (loadTrack(track) != nullptr) {  // indexes it
+            track->prefetched = true;
+        }
+#ifdef DEBUG_D88
+        Serial.printf("D88: read-ahead track %d\n", trackNo);
+#endif
+    } else {
+        free(buff);
+    }
+    xSemaphoreGive(mMutex);
+}
+
+// Reads and indexes a track; the caller holds mMutex.
+uint8_t* PC80D88::loadTrack(d88_track_t* track) {
     if (track->buff == nullptr) {
-        track->buff = (uint8_t*)ps_malloc(track->size);
-        if (track->buff == nullptr) {
+        auto buff = (uint8_t*)PC80HAL::alloc(track->size);
+        if (buff == nullptr) {
 #ifdef DEBUG_D88
-            Serial.printf("readData - ps_malloc error %d\n", track->size);
+            Serial.printf("readData - alloc error %d\n", track->size);
 #endif
             return nullptr;
         }
         fseek(mFP, track->offset, SEEK_SET);
-        size_t result = fread(track->buff, 1, track->size, mFP);
+        size_t result = fread(buff, 1, track->size, mFP);
         if (result != track->size) {
+            free(buff);
+            return nullptr;
+        }
+        track->buff = buff;
+        if (!applyOverlay(track)) {
+            track->buff = nullptr;
+            free(buff);
             return nullptr;
         }
 #ifdef DEBUG_D88
         Serial.println("readData - read buff");
 #endif
     }
+    if (track->index == nullptr) {
+        auto index = (d88_sector_index_t*)PC80HAL::alloc(sizeof(d88_sector_index_t));
+        if (index == nullptr) {
+            return nullptr;
+        }
+        indexTrack(track, index);
+        track->index = index;  // published last: getTrackBuffer checks it without the lock
+    }
     return track->buff;
 }
 
+// Walks the sector headers of a track once and records where each sector is.
+void PC80D88::indexTrack(d88_track_t* track, d88_sector_index_t* index) {
+    memset(index->byR, 0, sizeof(index->byR));
+    index->count = 0;
+
+    uint32_t offset = 0;
+    auto numberOfSector = ((d88_sector_header_t*)track->buff)->numberOfSector;
+    for (int i = 0; i < numberOfSector && i < D88_MAX_SECTORS; i++) {
+        if (offset + sizeof(d88_sector_header_t) > track->size) break;
+        auto header = (d88_sector_header_t*)(track->buff + offset);
+        if (offset + sizeof(d88_sector_header_t) + header->sizeOfData > track->size) break;
+
+        auto sector = &index->sector[index->count];
+        sector->geometry = header->geometry;
+        sector->offset = offset;
+        sector->size = header->sizeOfData;
+        index->count++;
+        if (index->byR[header->geometry.r] == 0) {
+            index->byR[header->geometry.r] = index->count;
+        }
+        offset += sizeof(d88_sector_header_t) + header->sizeOfData;
+    }
+}
+
+// chrn: C, H, R, N to match. Non-standard tracks may repeat R with another C, H or N.
+d88_sector_t* PC80D88::findSector(d88_track_t* track, const uint8_t* chrn) {
+    auto index = track->index;
+    auto i = index->byR[chrn[2]];
+    if (i == 0) {
+        return nullptr;
+    }
+    for (i--; i < index->count; i++) {
+        auto sector = &index->sector[i];
+        if (memcmp(&sector->geometry, chrn, sizeof(d88_geometry_t)) == 0) {
+            return sector;
+        }
+    }
+    return nullptr;
+}
+
 bool PC80D88::isReady(void) { return mFP != nullptr; }
 
 bool PC80D88::isWriteProtect(void) { return mWriteProtect; }
@@ -24,6 +24,7 @@
 
 #pragma GCC optimize("O2")
 
+#include <Arduino.h>
 #include <stdio.h>
 
 #include <cstring>
@@ -94,10 +95,57 @@ typedef struct {
     uint16_t sizeOfData;
 } d88_sector_header_t;
 
+#define D88_MAX_SECTORS (64)  // per track
+
+// Sector index of a track, built when the track is first accessed and after Write ID
+typedef struct {
+    d88_geometry_t geometry;
+    uint16_t offset;  // of the sector header in the track buffer
+    uint16_t size;    // of the data
+} d88_sector_t;
+
+typedef struct {
+    int count;
+    uint8_t byR[256];  // R -> 1 + first sector with that R, 0: none
+    d88_sector_t sector[D88_MAX_SECTORS];
+} d88_sector_index_t;
+
+#define D88_OVERLAY_ENTRIES (32)  // per track; a full track is then stored whole
+#define D88_OVERLAY_MAGIC "D88OVL1"
+
+// Overlay file: header, then records of a track number, a range in the track and its data.
+// Later records win; a record of the whole track supersedes the earlier ones of that track.
+typedef struct {
+    char magic[8];
+    uint32_t diskSize;  // of the base image
+} d88_overlay_header_t;
+
+typedef struct {
+    uint16_t track;
+    uint16_t size;
+    uint32_t offset;  // in the track
+} d88_overlay_record_t;
+
+typedef struct {
+    uint32_t offset;  // in the track
+    uint16_t size;
+    long position;  // of the data in the overlay file
+} d88_overlay_entry_t;
+
+typedef struct {
+    int count;
+    d88_overlay_entry_t entry[D88_OVERLAY_ENTRIES];
+} d88_overlay_t;
+
 typedef struct {
     int offset;
     uint32_t size;
     uint8_t* buff;
+    bool dirty;                  // whole track to be written back (Write ID)
+    uint64_t dirtySectors;       // bit n: data of index sector n to be written back
+    bool prefetched;             // loaded by read-ahead and not accessed yet
+    d88_sector_index_t* index;  // nullptr until the track is loaded; set last
+    d88_overlay_t* overlay;     // ranges of the track held in the overlay file, or nullptr
 } d88_track_t;
 
 typedef struct {
@@ -132,8 +180,13 @@ class PC80D88 {
     PC80D88();
     ~PC80D88();
 
-    int open(const char* fileName);
+    int open(const char* fileName, bool cache = false, bool overlay = false);
     int close(void);
+    int flush(void);
+    int commit(void);
+    int discard(void);
+    bool isOverlay(void) { return mOverlay; }
+    void setWriter(TaskHandle_t task) { mWriter = task; }
 
     int readData(uint8_t* dest, d88_io_parameter_t* ioParam);
     int readDiagnostic(uint8_t* dest, d88_io_parameter_t* ioParam);
@@ -148,14 +201,50 @@ class PC80D88 {
     static bool exists(const char* fileName);
 
     uint8_t* getTrackBuffer(int trackNo);
+    void prefetch(int trackNo);
+
+    uint32_t getReadAheadHits(void) { return mReadAheadHits; }
+    uint32_t getReadAheadMisses(void) { return mReadAheadMisses; }
 
    private:
     int mType;
     FILE* mFP;
+    char mFileName[256];
+
+    bool mOverlay;     // base image read-only, writes go to the overlay file
+    FILE* mOverlayFP;  // nullptr until the first write
+    char mOverlayName[256];
+
+    uint8_t* mImage;  // whole image in PSRAM, or nullptr when tracks are loaded on first access
+    SemaphoreHandle_t mMutex;
+    SemaphoreHandle_t mReadAheadMutex;  // guards mReadAheadFP; taken after mMutex, never before
+    FILE* mReadAheadFP;                 // second read-only handle, so read-ahead reads without mMutex
+    volatile uint32_t mGeneration;      // changes whenever an image is loaded
+    TaskHandle_t mWriter;  // notified when a track becomes dirty
     d88_header_t* mHeader;
     d88_track_t* mTrack;
     long mDiskSize;
     int mMaxTrack;
     int mNextSector;
     bool mWriteProtect;
+
+    uint32_t mReadAheadHits;    // first access found a track loaded by read-ahead
+    uint32_t mReadAheadMisses;  // first access had to load the track itself
+
+    int load(const char* fileName, bool cache, bool overlay);
+    void release(void);
+    int writeBack(void);
+    int writeTrack(int trackNo);
+    int writeRange(int trackNo, uint32_t offset, uint32_t size);
+
+    int openOverlay(void);
+    int readOverlay(void);
+    bool addOverlayEntry(d88_track_t* track, uint32_t offset, uint32_t size, long position);
+    bool applyOverlay(d88_track_t* track);
+    int writeOverlay(int trackNo, uint32_t offset, uint32_t size);
+    void dropOverlay(void);
+
+    uint8_t* loadTrack(d88_track_t* track);
+    void indexTrack(d88_track_t* track, d88_sector_index_t* index);
+    d88_sector_t* findSector(d88_track_t* track, const uint8_t* chrn);
 };
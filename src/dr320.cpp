@@ -109,6 +109,19 @@ int DR320::close(void) {
     return 0;
 }
 
+// Port 20h-2Fh: even ports are data, odd ports are status / mode
+void DR320::registerIO(PC80IO *io) {
+    io->setIn(0x20, 0x2f, ioInData, this, 2);
+    io->setIn(0x21, 0x2f, ioInStatus, this, 2);
+    io->setOut(0x20, 0x2f, ioOutData, this, 2);
+    io->setOut(0x21, 0x2f, ioOutMode, this, 2);
+}
+
+int DR320::ioInData(void *arg, int port) { return ((DR320 *)arg)->readData(); }
+int DR320::ioInStatus(void *arg, int port) { return ((DR320 *)arg)->readStatus(); }
+void DR320::ioOutData(void *arg, int port, int value) { ((DR320 *)arg)->writeData(value); }
+void DR320::ioOutMode(void *arg, int port, int value) { ((DR320 *)arg)->modeCommand(value); }
+
 uint8_t DR320::readData(void) {  // Port 20;
     uint8_t buf = 0xff;
 
@@ -27,6 +27,7 @@
 #include <cstdio>
 
 #include "fabgl.h"
+#include "pc80io.h"
 
 class DR320 {
    public:
@@ -40,11 +41,18 @@ class DR320 {
     uint8_t readStatus(void);
     void modeCommand(uint8_t value);
     void systemControl(uint8_t value);
+
+    void registerIO(PC80IO* io);
     void interrupt(void);
     void rewind(void);
     void eot(void);
 
    private:
+    static int ioInData(void* arg, int port);
+    static int ioInStatus(void* arg, int port);
+    static void ioOutData(void* arg, int port, int value);
+    static void ioOutMode(void* arg, int port, int value);
+
     FILE* mTape;
     uint8_t mStatus;
     bool mMode;
@@ -96,6 +96,15 @@ I8255::~I8255() {}
 
 static bool sendStatusCmd = false;
 
+// Port FCh-FFh (PC-8001 and PC-80S31)
+void I8255::registerIO(PC80IO *io) {
+    io->setIn(0xfc, 0xff, ioIn, this);
+    io->setOut(0xfc, 0xff, ioOut, this);
+}
+
+int I8255::ioIn(void *arg, int port) { return ((I8255 *)arg)->in(port & 0x03); }
+void I8255::ioOut(void *arg, int port, int value) { ((I8255 *)arg)->out(port & 0x03, value & 0xff); }
+
 uint8_t I8255::in(int port) {
     switch (port) {
         case I8255_PORT_A:
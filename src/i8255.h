@@ -26,6 +26,8 @@
 
 #include <cstdint>
 
+#include "pc80io.h"
+
 #define I8255_PORT_A 0
 #define I8255_PORT_B 1
 #define I8255_PORT_C 2
@@ -56,6 +58,8 @@ class I8255 {
 
     void setCallBack(i8255_callback_t *callBack, I8255 *i8255);
 
+    void registerIO(PC80IO *io);
+
     uint8_t mPortA;
     uint8_t mPortB;
     uint8_t mPortC;
@@ -81,5 +85,8 @@ class I8255 {
     bool mATN;
 
     void control(uint8_t value);
+
+    static int ioIn(void *arg, int port);
+    static void ioOut(void *arg, int port, int value);
     const char *getID(void);
 };
\ No newline at end of file
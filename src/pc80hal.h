@@ -0,0 +1,55 @@
+/*
+    This file is part of PC8001FabGL.
+
+    https://github.com/Basara767676/PC8001FabGL
+
+    Copyright (C) 2022 Basara767676
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#pragma GCC optimize("O2")
+
+#include <Arduino.h>
+
+#ifdef DEBUG_PC80
+// #define PC80_BENCHMARK  // print emulated MHz, frame rates and disk throughput every second
+#endif
+
+#define HAL_CORE_VM (PRO_CPU_NUM)
+#define HAL_CORE_IO (APP_CPU_NUM)
+
+// Memory, task and time helpers used in place of direct ps_malloc, heap_caps_malloc and
+// xTaskCreateUniversal calls. The devices still depend on FabGL and FreeRTOS directly.
+class PC80HAL {
+   public:
+    // Large buffers (PSRAM)
+    static void *alloc(size_t size) { return ps_malloc(size); }
+
+    // Small buffers used by the video ISR and hot loops (internal RAM)
+    static void *allocInternal(size_t size) { return heap_caps_malloc(size, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL); }
+    static void *allocInternal32(size_t size) { return heap_caps_malloc(size, MALLOC_CAP_32BIT | MALLOC_CAP_INTERNAL); }
+
+    static TaskHandle_t createTask(TaskFunction_t task, const char *name, uint32_t stackSize, void *arg, int priority, int core) {
+        TaskHandle_t handle = nullptr;
+        xTaskCreateUniversal(task, name, stackSize, arg, priority, &handle, core);
+        return handle;
+    }
+
+    static uint32_t millis(void) { return ::millis(); }
+    static uint32_t micros(void) { return ::micros(); }
+};
@@ -0,0 +1,63 @@
+/*
+    This file is part of PC8001FabGL.
+
+    https://github.com/Basara767676/PC8001FabGL
+
+    Copyright (C) 2022 Basara767676
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "pc80io.h"
+
+#include <Arduino.h>
+
+#ifdef DEBUG_PC80
+// #define DEBUG_PC80IO
+#endif
+
+PC80IO::PC80IO() {
+    setIn(0x00, 0xff, inNone, nullptr);
+    setOut(0x00, 0xff, outNone, nullptr);
+}
+
+PC80IO::~PC80IO() {}
+
+void PC80IO::setIn(int first, int last, io_in_t handler, void *arg, int step) {
+    for (int port = first; port <= last; port += step) {
+        mIn[port & 0xff].handler = handler;
+        mIn[port & 0xff].arg = arg;
+    }
+}
+
+void PC80IO::setOut(int first, int last, io_out_t handler, void *arg, int step) {
+    for (int port = first; port <= last; port += step) {
+        mOut[port & 0xff].handler = handler;
+        mOut[port & 0xff].arg = arg;
+    }
+}
+
+int PC80IO::inNone(void *arg, int port) {
+#ifdef DEBUG_PC80IO
+    Serial.printf("Read non-implemeted port %02x\n", port);
+#endif
+    return 0;
+}
+
+void PC80IO::outNone(void *arg, int port, int value) {
+#ifdef DEBUG_PC80IO
+    Serial.printf("Write non-implemeted port %02x %02x\n", port, value);
+#endif
+}
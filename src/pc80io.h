@@ -0,0 +1,68 @@
+/*
+    This file is part of PC8001FabGL.
+
+    https://github.com/Basara767676/PC8001FabGL
+
+    Copyright (C) 2022 Basara767676
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#pragma GCC optimize("O2")
+
+#include <cstdint>
+
+typedef int (*io_in_t)(void *arg, int port);
+typedef void (*io_out_t)(void *arg, int port, int value);
+
+typedef struct {
+    io_in_t handler;
+    void *arg;
+} io_in_entry_t;
+
+typedef struct {
+    io_out_t handler;
+    void *arg;
+} io_out_entry_t;
+
+// 256-entry I/O port dispatch table.
+// Devices fill in their ports with setIn/setOut; unregistered ports read 0 and ignore writes.
+class PC80IO {
+   public:
+    PC80IO();
+    ~PC80IO();
+
+    void setIn(int first, int last, io_in_t handler, void *arg, int step = 1);
+    void setOut(int first, int last, io_out_t handler, void *arg, int step = 1);
+
+    inline int in(int port) {
+        auto entry = &mIn[port & 0xff];
+        return entry->handler(entry->arg, port & 0xff);
+    }
+
+    inline void out(int port, int value) {
+        auto entry = &mOut[port & 0xff];
+        entry->handler(entry->arg, port & 0xff, value);
+    }
+
+   private:
+    io_in_entry_t mIn[256];
+    io_out_entry_t mOut[256];
+
+    static int inNone(void *arg, int port);
+    static void outNone(void *arg, int port, int value);
+};
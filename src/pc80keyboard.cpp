@@ -61,6 +61,9 @@ int PC80KeyBoard::init(uint8_t *keyMap, void (*callBack)(void *, int), void *arg
 
     mPadEnter = false;
 
+    mWakeTask = nullptr;
+    mIdle = nullptr;
+
     return 0;
 }
 
@@ -81,7 +84,7 @@ void PC80KeyBoard::suspend(bool value) {
     mSuspending = value;
 }
 
-void PC80KeyBoard::run(void) { xTaskCreateUniversal(&keyBoardTask, "keyBoardTaskTask", 2048, this, 1, &mTaskHandle, APP_CPU_NUM); }
+void PC80KeyBoard::run(void) { mTaskHandle = PC80HAL::createTask(&keyBoardTask, "keyBoardTaskTask", 2048, this, 1, HAL_CORE_IO); }
 
 #define LEFT_SHIFT (0x12)
 #define RIGHT_SHIFT (0x59)
@@ -119,6 +122,9 @@ void IRAM_ATTR PC80KeyBoard::keyBoardTask(void *pvParameters) {
     while (true) {
         while (keyboard->scancodeAvailable() && !kb->mSuspending) {
             auto scanCode = keyboard->getNextScancode();
+            if (scanCode != -1 && kb->mWakeTask && *kb->mIdle) {
+                xTaskNotifyGive(kb->mWakeTask);
+            }
             if (scanCode != -1) {
                 if (scanCode == 0xe0) {
                     e0 = true;
@@ -298,4 +304,9 @@ void IRAM_ATTR PC80KeyBoard::updateKeyMap(bool keyUp, int scanCode) {
     }
 }
 
-void PC80KeyBoard::setPadEnter(bool value) { mPadEnter = value; }
\ No newline at end of file
+void PC80KeyBoard::setPadEnter(bool value) { mPadEnter = value; }
+
+void PC80KeyBoard::setWakeTask(TaskHandle_t task, volatile bool *idle) {
+    mIdle = idle;
+    mWakeTask = task;
+}
\ No newline at end of file
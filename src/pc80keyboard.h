@@ -42,6 +42,7 @@ class PC80KeyBoard {
     void suspend(bool value);
     void reset(void);
     void setPadEnter(bool value);
+    void setWakeTask(TaskHandle_t task, volatile bool *idle);
 
    private:
     fabgl::PS2Controller PS2Controller;
@@ -72,6 +73,9 @@ class PC80KeyBoard {
     bool mSuspending;
     TaskHandle_t mTaskHandle;
 
+    TaskHandle_t mWakeTask;  // notified on key input while *mIdle is set
+    volatile bool *mIdle;
+
     void (*mCallBack)(void *, int);
     void *mArg;
 
@@ -62,8 +62,13 @@ PC80MENU::~PC80MENU() {}
 #define MENU_PCG (5)
 #define MENU_BASIC_ON_RAM (6)
 #define MENU_PAD_ENTER (7)
-#define MENU_UPDATE_FW (8)
-#define MENU_ABOUT (9)
+#define MENU_HLE (8)
+#define MENU_VIDEO (9)
+#define MENU_SCREENSHOT (10)
+#define MENU_DISK_CACHE (11)
+#define MENU_DISK_OVERLAY (12)
+#define MENU_UPDATE_FW (13)
+#define MENU_ABOUT (14)
 
 #define MENU_CREATE_TAPE (0)
 #define MENU_RENAME_TAPE (1)
@@ -73,6 +78,10 @@ PC80MENU::~PC80MENU() {}
 #define MENU_PROTECT_DISK (5)
 #define MENU_DELETE_DISK (6)
 
+#define MENU_EJECT_DISK (0)
+#define MENU_COMMIT_OVERLAY (1)
+#define MENU_DISCARD_OVERLAY (2)
+
 int PC80MENU::menu(PC80VM *vm) {
     int rc;
 
@@ -151,10 +160,11 @@ int PC80MENU::miscSettings(fabgl::InputBox *ib) {
     do {
         sprintf(mMenuItem,
                 "File Manager;CPU Speed: %s;Volume: %d;ROM area: %s;Expansion unit: %s;PCG: %S;BASIC on RAM;Behavior of PAD enter key: "
-                "%s;Update firmware;About this program",
+                "%s;ROM acceleration: %s;Screen refresh: %s;Save screenshot;Disk cache: %s;Disk overlay: %s;Update firmware;About this program",
                 cpuSpeedStr(current->speed), current->volume, getMode(PROM_MODE, current->prom, pc80Settings->getProm()),
                 getExpUnitMode(current->expunit, pc80Settings->getExpUnit()), current->pcg ? "on" : "off",
-                current->padEnter ? "Behave as equal key (=)" : "Behave as RETURN key");
+                current->padEnter ? "Behave as equal key (=)" : "Behave as RETURN key", current->hle ? "on" : "off",
+                videoModeStr(current->video), current->diskCache ? "on" : "off", current->diskOverlay ? "on" : "off");
         rc = ib->menu(mMenuTitle, "Select an item           ", mMenuItem);
         switch (rc) {
             case MENU_FILE_MANAGER:
@@ -191,6 +201,32 @@ int PC80MENU::miscSettings(fabgl::InputBox *ib) {
                 pc80Settings->save();
                 rc = MENU_CONTINUE;
                 break;
+            case MENU_HLE:
+                current->hle = !current->hle;
+                pc80Settings->setHLE(current->hle);
+                pc80Settings->save();
+                rc = MENU_CONTINUE;
+                break;
+            case MENU_VIDEO:
+                rc = videoMode(ib, current, pc80Settings);
+                break;
+            case MENU_SCREENSHOT:
+                rc = saveScreenshot(ib);
+                break;
+            case MENU_DISK_CACHE:
+                current->diskCache = !current->diskCache;
+                pc80Settings->setDiskCache(current->diskCache);
+                pc80Settings->save();
+                mVM->getPC80S31()->setDiskCache(current->diskCache);  // from the next mount
+                rc = MENU_CONTINUE;
+                break;
+            case MENU_DISK_OVERLAY:
+                current->diskOverlay = !current->diskOverlay;
+                pc80Settings->setDiskOverlay(current->diskOverlay);
+                pc80Settings->save();
+                mVM->getPC80S31()->setDiskOverlay(current->diskOverlay);  // from the next mount
+                rc = MENU_CONTINUE;
+                break;
             case MENU_UPDATE_FW:
                 rc = updateFirmware(ib);
                 break;
@@ -208,13 +244,30 @@ int PC80MENU::miscSettings(fabgl::InputBox *ib) {
 int PC80MENU::diskSelector(fabgl::InputBox *ib, PC80SETTINGS *pc80Settings, int driveNo, char *driveStr) {
     if (strlen(driveStr) > 0) {
         sprintf(mMenuMsg, "Eject the disk file for drive %d", driveNo + 1);
-        sprintf(mMenuItem, "Eject: %s", driveStr);
+        auto pc80s31 = mVM->getPC80S31();
+        if (pc80s31->isOverlay(driveNo)) {
+            sprintf(mMenuItem, "Eject: %s;Commit changes to the disk file;Discard changes", driveStr);
+        } else {
+            sprintf(mMenuItem, "Eject: %s", driveStr);
+        }
         auto value = ib->menu(mMenuTitle, mMenuMsg, mMenuItem);
-        if (value == 0) {
-            strcpy(driveStr, "");
-            pc80Settings->setDisk(driveNo, driveStr);
-            pc80Settings->save();
-            mVM->getPC80S31()->closeDrive(driveNo);
+        switch (value) {
+            case MENU_EJECT_DISK:
+                strcpy(driveStr, "");
+                pc80Settings->setDisk(driveNo, driveStr);
+                pc80Settings->save();
+                pc80s31->closeDrive(driveNo);
+                break;
+            case MENU_COMMIT_OVERLAY:
+                if (pc80s31->commitOverlay(driveNo) < 0) {
+                    ib->message("Error: cannot commit", driveStr, nullptr);
+                }
+                break;
+            case MENU_DISCARD_OVERLAY:
+                if (pc80s31->discardOverlay(driveNo) < 0) {
+                    ib->message("Error: cannot reopen", driveStr, nullptr);
+                }
+                break;
         }
     } else {
         strcpy(mPath, SD_MOUNT_POINT);
@@ -452,7 +505,7 @@ int PC80MENU::createDisk(fabgl::InputBox *ib, pc80_settings_t *current, PC80SETT
             return MENU_CONTINUE;
         }
 
-        auto buf = (uint8_t *)ps_malloc(16 * (sizeof(d88_sector_header_t) + 0x100));
+        auto buf = (uint8_t *)PC80HAL::alloc(16 * (sizeof(d88_sector_header_t) + 0x100));
 
         auto r = ib->progressBox("Creating a new disk", nullptr, true, 200, [&](fabgl::ProgressForm *form) {
             fp = fopen(mPath, "w");
@@ -766,8 +819,12 @@ int PC80MENU::setExpansionUnit(fabgl::InputBox *ib, PC80SETTINGS *pc80Settings)
 const char *PC80MENU::cpuSpeedStr(int i) {
     static const char *str[10] = {"No wait", "Very very fast", "Very fast", "Fast",      "A little fast",
                                   "Normal",  "A little slow",  "Slow",      "Very slow", "Very very slow"};
-    if (0 <= i && i < 10) {
+    static char buf[32];
+    if (i == CPU_SPEED_NO_WAIT) {
         return str[i];
+    } else if (0 < i && i < 10) {
+        sprintf(buf, "%s (%d%%)", str[i], PC80VM::getCpuSpeedPercent(i));
+        return buf;
     } else {
         return "Unknown";
     }
@@ -790,6 +847,52 @@ int PC80MENU::cpuSpeed(fabgl::InputBox *ib, pc80_settings_t *current, PC80SETTIN
     return MENU_TO_VM;
 }
 
+int PC80MENU::saveScreenshot(fabgl::InputBox *ib) {
+    // Next free file name: SCR0000.PPM, SCR0001.PPM, ...
+    for (int i = 0; i < 10000; i++) {
+        sprintf(mPath, "%s%s%s/SCR%04d.PPM", SD_MOUNT_POINT, PC80DIR, PC80DIR_SCREEN, i);
+        FILE *fp = fopen(mPath, "rb");
+        if (!fp) {
+            if (mVM->getPD3301()->saveScreenshot(mPath) == 0) {
+                sprintf(mPath, "Saved: SCR%04d.PPM", i);
+                ib->message("Screenshot", mPath, nullptr);
+            } else {
+                ib->message("Error", "Could not save the screenshot.", nullptr);
+            }
+            return MENU_CONTINUE;
+        }
+        fclose(fp);
+    }
+    ib->message("Error", "Too many screenshots.", nullptr);
+    return MENU_CONTINUE;
+}
+
+const char *PC80MENU::videoModeStr(int i) {
+    static const char *str[5] = {"60Hz", "30Hz", "20Hz", "15Hz", "Auto"};
+    if (VIDEO_60HZ <= i && i <= VIDEO_AUTO) {
+        return str[i];
+    } else {
+        return "Unknown";
+    }
+}
+
+int PC80MENU::videoMode(fabgl::InputBox *ib, pc80_settings_t *current, PC80SETTINGS *pc80Settings) {
+    mMenuItem[0] = 0;
+    for (int i = VIDEO_60HZ; i <= VIDEO_AUTO; i++) {
+        strcat(mMenuItem, videoModeStr(i));
+        strcat(mMenuItem, ";");
+    }
+    mMenuItem[strlen(mMenuItem) - 1] = 0;
+    int value = ib->select("Screen refresh", "Select refresh rate", mMenuItem);
+    if (VIDEO_60HZ <= value && value <= VIDEO_AUTO) {
+        mVM->getPD3301()->setVideoMode(value);
+        current->video = value;
+        pc80Settings->setVideo(value);
+        pc80Settings->save();
+    }
+    return MENU_CONTINUE;
+}
+
 bool PC80MENU::isMounted(const char *fileName, pc80_settings_t *current) {
     for (int i = 0; i < 4; i++) {
         if (strcmp(fileName, current->disk[i]) == 0) return true;
@@ -51,6 +51,9 @@ class PC80MENU {
     int setExpansionUnit(fabgl::InputBox *ib, PC80SETTINGS *pc80Settings);
     int cpuSpeed(fabgl::InputBox *ib, pc80_settings_t *current, PC80SETTINGS *pc80Settings);
     const char *cpuSpeedStr(int i);
+    int saveScreenshot(fabgl::InputBox *ib);
+    int videoMode(fabgl::InputBox *ib, pc80_settings_t *current, PC80SETTINGS *pc80Settings);
+    const char *videoModeStr(int i);
 
     bool isMounted(const char *fileName, pc80_settings_t *current);
 };
\ No newline at end of file
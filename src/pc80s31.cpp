@@ -49,8 +49,14 @@ int PC80S31::init(PC80VM *vm, uint8_t *mem, I8255 *i8255) {
     callback.portC = &mI8255->portC;
     i8255->setCallBack(&callback, mI8255);
 
+    mScheduler = new PC80SCHEDULER;
+
     mPD765C = new PD765C;
-    mPD765C->setIRQFlag(&mIRQ);
+    mPD765C->setIRQFlag(&mIRQ, mScheduler);
+
+    mIO = new PC80IO;
+    mPD765C->registerIO(mIO);
+    mI8255->registerIO(mIO);
 
     mPD780C = new fabgl::Z80;
     mPD780C->setCallbacks(this, readByte, writeByte, readWord, writeWord, readIO, writeIO);
@@ -76,13 +82,23 @@ int IRAM_ATTR PC80S31::run(void) {
             if (mPD780C->getIFF1() && mIRQ) {
                 mPD780C->IRQ(0x00);
                 mIRQ = false;
+            } else {
+                // Nothing to run until the next event (e.g. FDC interrupt)
+                mScheduler->skip();
             }
         } else {
-            mPD780C->step();
+            int budget = mScheduler->remaining();
+            if (budget > PC80S31_BATCH_CYCLES) budget = PC80S31_BATCH_CYCLES;
+            int cycles = 0;
+            do {
+                cycles += mPD780C->step();
+            } while (cycles < budget && mPD780C->getStatus() != fabgl::Z80_STATUS_HALT);
+            mScheduler->advance(cycles);
         }
         if (mReset) {
             mReset = false;
             mIRQ = false;
+            mScheduler->reset();
             mPD780C->reset();
             mPD780C->setPC(0);
         }
@@ -103,79 +119,50 @@ void IRAM_ATTR PC80S31::writeByte(void *context, int address, int value) {
     }
 }
 
-int IRAM_ATTR PC80S31::readWord(void *context, int addr) { return readByte(context, addr) | (readByte(context, addr + 1) << 8); }
+int IRAM_ATTR PC80S31::readWord(void *context, int addr) {
+    if (addr < 0x7fff) {
+        auto p = ((PC80S31 *)context)->mMem + addr;
+        if (addr & 1) {
+            return p[0] | (p[1] << 8);
+        }
+        return *(uint16_t *)p;
+    }
+    return readByte(context, addr) | (readByte(context, addr + 1) << 8);
+}
 
 void IRAM_ATTR PC80S31::writeWord(void *context, int addr, int value) {
+    if (0x4000 <= addr && addr < 0x7fff) {
+        auto p = ((PC80S31 *)context)->mMem + addr;
+        if (addr & 1) {
+            p[0] = value;
+            p[1] = value >> 8;
+        } else {
+            *(uint16_t *)p = value;
+        }
+        return;
+    }
     writeByte(context, addr, value & 0xFF);
     writeByte(context, addr + 1, value >> 8);
 }
 
-int PC80S31::readIO(void *context, int address) {
-    auto vm = (PC80S31 *)context;
-
-    switch (address) {
-        case 0xf8:
-            return vm->mPD765C->terminalCount();
-        case 0xfa:
-            return vm->mPD765C->readStatusRegister();
-        case 0xfb:
-            return vm->mPD765C->readDataRegister();
-        case 0xfc:
-            return vm->mI8255->in(I8255_PORT_A);
-        case 0xfd:
-            return vm->mI8255->in(I8255_PORT_B);
-        case 0xfe:
-            return vm->mI8255->in(I8255_PORT_C);
-        case 0xff:
-            return vm->mI8255->in(I8255_PORT_CONTROL);
-        default:
-#ifdef DEBUG_PC80S31
-            Serial.printf("80S31 Read value from non-implemeted port %02x\n", address);
-#endif
-            break;
-    }
-
-    return 0;
-}
+int IRAM_ATTR PC80S31::readIO(void *context, int address) { return ((PC80S31 *)context)->mIO->in(address); }
 
-void PC80S31::writeIO(void *context, int address, int value) {
-    auto vm = (PC80S31 *)context;
-
-    switch (address) {
-        case 0xf4:
-            vm->mPD765C->writeF4(value);
-            break;
-        case 0xf7:  // Window value for VFO
-            vm->mPD765C->writeF7(value);
-            break;
-        case 0xf8:  //
-            vm->mPD765C->writeF8(value);
-            break;
-        case 0xfb:
-            vm->mPD765C->writeDataRegister(value);
-            break;
-        case 0xfc:
-            vm->mI8255->out(I8255_PORT_A, value & 0xff);
-            break;
-        case 0xfd:
-            vm->mI8255->out(I8255_PORT_B, value & 0xff);
-            break;
-        case 0xfe:
-            vm->mI8255->out(I8255_PORT_C, value & 0xff);
-            break;
-        case 0xff:
-            vm->mI8255->out(I8255_PORT_CONTROL, value & 0xff);
-            break;
-        default:
-#ifdef DEBUG_PC80S31
-            Serial.printf("80S31 Write %02x to non-implemeted port %02x\n", value, address);
-#endif
-            break;
-    }
-}
+void IRAM_ATTR PC80S31::writeIO(void *context, int address, int value) { ((PC80S31 *)context)->mIO->out(address, value); }
 
 int PC80S31::openDrive(int drive, char *fileName) { return mPD765C->openDrive(drive, fileName); }
 
 int PC80S31::closeDrive(int drive) { return mPD765C->closeDrive(drive); }
 
-void PC80S31::eject(void) { mPD765C->eject(); }
\ No newline at end of file
+void PC80S31::eject(void) { mPD765C->eject(); }
+
+void PC80S31::flush(void) { mPD765C->flush(); }
+
+void PC80S31::setDiskCache(bool value) { mPD765C->setDiskCache(value); }
+
+void PC80S31::setDiskOverlay(bool value) { mPD765C->setDiskOverlay(value); }
+
+int PC80S31::commitOverlay(int drive) { return mPD765C->commitOverlay(drive); }
+
+int PC80S31::discardOverlay(int drive) { return mPD765C->discardOverlay(drive); }
+
+bool PC80S31::isOverlay(int drive) { return mPD765C->isOverlay(drive); }
\ No newline at end of file
@@ -32,6 +32,8 @@ class PC80VM;
 
 #define DRIVES 4
 
+#define PC80S31_BATCH_CYCLES (400)
+
 class PC80S31 {
    public:
     PC80S31();
@@ -54,12 +56,27 @@ class PC80S31 {
     int closeDrive(int drive);
 
     void eject(void);
+    void flush(void);
+    void setDiskCache(bool value);
+    void setDiskOverlay(bool value);
+    int commitOverlay(int drive);
+    int discardOverlay(int drive);
+    bool isOverlay(int drive);
+
+#ifdef PC80_BENCHMARK
+    uint32_t getTransferred(void) { return mPD765C->getTransferred(); }
+    uint32_t getReadAheadHits(void) { return mPD765C->getReadAheadHits(); }
+    uint32_t getReadAheadMisses(void) { return mPD765C->getReadAheadMisses(); }
+#endif
 
    private:
     fabgl::Z80 *mPD780C;
     I8255 *mI8255;
     PD765C *mPD765C;
 
+    PC80SCHEDULER *mScheduler;
+    PC80IO *mIO;
+
     bool mReset;
     bool mIRQ;
 
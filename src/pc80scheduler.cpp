@@ -0,0 +1,101 @@
+/*
+    This file is part of PC8001FabGL.
+
+    https://github.com/Basara767676/PC8001FabGL
+
+    Copyright (C) 2022 Basara767676
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "pc80scheduler.h"
+
+#include <Arduino.h>
+
+#ifdef DEBUG_PC80
+// #define DEBUG_PC80SCHEDULER
+#endif
+
+PC80SCHEDULER::PC80SCHEDULER() {
+    mEvents = 0;
+    mNow = 0;
+    reset();
+}
+
+PC80SCHEDULER::~PC80SCHEDULER() {}
+
+void PC80SCHEDULER::reset(void) {
+    for (int i = 0; i < SCHEDULER_MAX_EVENTS; i++) {
+        mEvent[i].active = false;
+    }
+    update();
+}
+
+int PC80SCHEDULER::add(scheduler_callback_t callback, void *arg) {
+    if (mEvents >= SCHEDULER_MAX_EVENTS) {
+#ifdef DEBUG_PC80SCHEDULER
+        Serial.println("PC80SCHEDULER: too many events");
+#endif
+        return -1;
+    }
+    auto event = &mEvent[mEvents];
+    event->active = false;
+    event->callback = callback;
+    event->arg = arg;
+    return mEvents++;
+}
+
+// Fire the event after the given number of cycles from now.
+void PC80SCHEDULER::schedule(int id, int cycles) {
+    mEvent[id].time = mNow + cycles;
+    mEvent[id].active = true;
+    update();
+}
+
+void PC80SCHEDULER::cancel(int id) {
+    mEvent[id].active = false;
+    update();
+}
+
+void IRAM_ATTR PC80SCHEDULER::advance(int cycles) {
+    uint32_t target = mNow + cycles;
+    while (mNext >= 0 && (int32_t)(target - mNextTime) >= 0) {
+        auto event = &mEvent[mNext];
+        // Callbacks see the time the event was due, so periodic events do not drift.
+        mNow = event->time;
+        event->active = false;
+        event->callback(event->arg);
+        update();
+    }
+    mNow = target;
+    if (mNext < 0) mNextTime = mNow + SCHEDULER_IDLE_CYCLES;
+}
+
+// Jump to the next event without executing any instruction (e.g. the CPU is halted).
+void PC80SCHEDULER::skip(void) {
+    if (mNext >= 0) advance(remaining());
+}
+
+void IRAM_ATTR PC80SCHEDULER::update(void) {
+    mNext = -1;
+    int32_t next = SCHEDULER_IDLE_CYCLES;
+    for (int i = 0; i < mEvents; i++) {
+        if (mEvent[i].active && (int32_t)(mEvent[i].time - mNow) < next) {
+            next = mEvent[i].time - mNow;
+            mNext = i;
+        }
+    }
+    mNextTime = mNow + next;
+}
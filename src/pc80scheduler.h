@@ -0,0 +1,70 @@
+/*
+    This file is part of PC8001FabGL.
+
+    https://github.com/Basara767676/PC8001FabGL
+
+    Copyright (C) 2022 Basara767676
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#pragma GCC optimize("O2")
+
+#include <cstdint>
+
+#define SCHEDULER_MAX_EVENTS (8)
+#define SCHEDULER_IDLE_CYCLES (0x10000000)
+
+typedef void (*scheduler_callback_t)(void *arg);
+
+typedef struct {
+    bool active;
+    uint32_t time;
+    scheduler_callback_t callback;
+    void *arg;
+} scheduler_event_t;
+
+// Event scheduler keyed on emulated CPU cycles.
+// Devices register a callback with add() and arm it with schedule(). The CPU loop runs
+// up to remaining() cycles and then calls advance(), which fires every event that is due.
+class PC80SCHEDULER {
+   public:
+    PC80SCHEDULER();
+    ~PC80SCHEDULER();
+
+    void reset(void);
+
+    int add(scheduler_callback_t callback, void *arg);
+    void schedule(int id, int cycles);
+    void cancel(int id);
+    bool isScheduled(int id) { return mEvent[id].active; }
+
+    int remaining(void) { return (int32_t)(mNextTime - mNow); }
+    void advance(int cycles);
+    void skip(void);
+
+    uint32_t getTime(void) { return mNow; }
+
+   private:
+    uint32_t mNow;
+    uint32_t mNextTime;
+    int mNext;
+    int mEvents;
+    scheduler_event_t mEvent[SCHEDULER_MAX_EVENTS];
+
+    void update(void);
+};
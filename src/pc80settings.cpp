@@ -36,13 +36,17 @@
 
 #define SETTING_FILE_NAME "settings.ini"
 
-setting_type_t PC80SETTINGS::settings[12] = {{"PC80S31", TYPE_BOOL, &mSettings.drive, nullptr},
+setting_type_t PC80SETTINGS::settings[16] = {{"PC80S31", TYPE_BOOL, &mSettings.drive, nullptr},
                                              {"PROM", TYPE_BOOL, &mSettings.prom, nullptr},
                                              {"PCG", TYPE_BOOL, &mSettings.pcg, nullptr},
                                              {"PADENTER", TYPE_BOOL, &mSettings.padEnter, nullptr},
+                                             {"HLE", TYPE_BOOL, &mSettings.hle, nullptr},
+                                             {"DISKCACHE", TYPE_BOOL, &mSettings.diskCache, nullptr},
+                                             {"OVERLAY", TYPE_BOOL, &mSettings.diskOverlay, nullptr},
                                              {"EXPUNIT", TYPE_INT, &mSettings.expunit, &expUnitValidate},
                                              {"VOLUME", TYPE_INT, &mSettings.volume, &volumeValidate},
                                              {"SPEED", TYPE_INT, &mSettings.speed, &speedValidate},
+                                             {"VIDEO", TYPE_INT, &mSettings.video, &videoValidate},
                                              {"TAPE", TYPE_STRING, &mSettings.tape, nullptr},
                                              {"DISK0", TYPE_STRING, &mSettings.disk[0], nullptr},
                                              {"DISK1", TYPE_STRING, &mSettings.disk[1], nullptr},
@@ -59,12 +63,16 @@ int PC80SETTINGS::init(char *rootDir) {
     mSettings.prom = false;
     mSettings.expunit = 0;
     mSettings.pcg = false;
+    mSettings.hle = false;
+    mSettings.diskCache = false;
+    mSettings.diskOverlay = false;
     mSettings.speed = 4;
+    mSettings.video = 0;
 
     char **items[] = {&mSettings.rom, &mSettings.tape, &mSettings.disk[0], &mSettings.disk[1], &mSettings.disk[2], &mSettings.disk[3]};
 
     for (int i = 0; i < 6; i++) {
-        *items[i] = (char *)ps_malloc(256);
+        *items[i] = (char *)PC80HAL::alloc(256);
         strcpy(*items[i], "");
     }
 
@@ -259,7 +267,14 @@ void PC80SETTINGS::expUnitValidate(void *arg) {
 
 void PC80SETTINGS::speedValidate(void *arg) {
     auto value = (int *)arg;
-    if (*value < 0 || *value > 8) {
+    if (*value < 0 || *value > 9) {
         *value = 4;
     }
 }
+
+void PC80SETTINGS::videoValidate(void *arg) {
+    auto value = (int *)arg;
+    if (*value < 0 || *value > 4) {
+        *value = 0;
+    }
+}
@@ -28,15 +28,20 @@
 #include <cstring>
 
 #include "fabgl.h"
+#include "pc80hal.h"
 
 typedef struct {
     bool prom;
     bool drive;
     bool padEnter;
     bool pcg;
+    bool hle;
+    bool diskCache;
+    bool diskOverlay;
     int volume;
     int expunit;
     int speed;
+    int video;
     char *rom;
     char *tape;
     char *disk[4];
@@ -75,6 +80,18 @@ class PC80SETTINGS {
     static void setPCG(bool value) { mSettings.pcg = value; }
     static int getPCG(void) { return mSettings.pcg; }
 
+    static void setHLE(bool value) { mSettings.hle = value; }
+    static bool getHLE(void) { return mSettings.hle; }
+
+    static void setDiskCache(bool value) { mSettings.diskCache = value; }
+    static bool getDiskCache(void) { return mSettings.diskCache; }
+
+    static void setDiskOverlay(bool value) { mSettings.diskOverlay = value; }
+    static bool getDiskOverlay(void) { return mSettings.diskOverlay; }
+
+    static void setVideo(int value) { mSettings.video = value; }
+    static int getVideo(void) { return mSettings.video; }
+
     static void setTape(const char *fileName) { strcpy(mSettings.tape, fileName); }
     static void setDisk(const int index, const char *fileName) {
         switch (index) {
@@ -94,7 +111,7 @@ class PC80SETTINGS {
     }
 
     static pc80_settings_t *get(void) {
-        auto dest = (pc80_settings_t *)heap_caps_malloc(sizeof(pc80_settings_t), MALLOC_CAP_SPIRAM);
+        auto dest = (pc80_settings_t *)PC80HAL::alloc(sizeof(pc80_settings_t));
         if (dest != nullptr) {
             memcpy(dest, &mSettings, sizeof(pc80_settings_t));
         }
@@ -108,7 +125,7 @@ class PC80SETTINGS {
    private:
     static pc80_settings_t mSettings;
 
-    static setting_type_t settings[12];
+    static setting_type_t settings[16];
     static char fileName[64];
 
     static void loadBool(char *buf, int i);
@@ -127,4 +144,5 @@ class PC80SETTINGS {
     static void tvramValidate(void *arg);
     static void expUnitValidate(void *arg);
     static void speedValidate(void *arg);
+    static void videoValidate(void *arg);
 };
\ No newline at end of file
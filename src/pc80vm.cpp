@@ -32,6 +32,9 @@
 #define EXP_UNIT_PC8011 (1)
 #define EXP_UNIT_PC8012 (2)
 
+#define CPU_BATCH_CYCLES (400)  // 100us at 4MHz
+#define VSYNC_TIMEOUT (pdMS_TO_TICKS(50))
+
 PC80VM::PC80VM() {}
 PC80VM::~PC80VM() {}
 
@@ -42,13 +45,25 @@ int PC80VM::init(void) {
     mPC80Settings->init(mRootDir);
     mSettings = mPC80Settings->get();
 
+    mScheduler = new PC80SCHEDULER;
+    mFrameEvent = mScheduler->add(frameEvent, this);
+
+    mIO = new PC80IO;
+    initIO();
+
     mPD3301 = new PD3301;
-    mPD3301->init(&mPort40In);
+    auto rc = mPD3301->init(&mPort40In, mScheduler);
     PC80ERROR::setDisplayController(mPD3301->getDisplayController());
+    if (rc < 0) {
+        PC80ERROR::dialog("Memory allocation error");
+        while (true) vTaskDelay(portMAX_DELAY);  // the screen cannot be drawn
+    }
+    mPD3301->registerIO(mIO);
 
     mPD3301->run();
 
     initMemory();
+    initHLE();
     initFont();
     initDisk();
 
@@ -58,19 +73,24 @@ int PC80VM::init(void) {
 
     mPD8257 = new PD8257;
     mPD8257->init(this);
+    mPD8257->registerIO(mIO);
 
     mI8255 = new I8255;
     mI8255->init(I8255_PC8001);
+    mI8255->registerIO(mIO);
 
     mPD1990 = new PD1990;
+    mPD1990->registerIO(mIO);
 
     mPC80S31 = new PC80S31;
     mPC80S31->init(this, mDiskROM, mI8255);
 
     mPCG8100 = new PCG8100;
-    mPCG8100->init(mFontROM, mSettings->volume);
+    mPCG8100->init(mFontROM, mSettings->volume, mPD3301);
+    mPCG8100->registerIO(mIO);
 
     mDR320 = new DR320;
+    mDR320->registerIO(mIO);
 
     mKeyboard = new PC80KeyBoard;
     mKeyboard->init(&mKeyMap[0], PC80VM::keyboardCallBack, this);
@@ -97,22 +117,19 @@ void PC80VM::coldBoot(void) {
 
     mPortE2 = 0xf0;
 
-    mNoWait = false;
-    mWait = 6;
-
     setCpuSpeed(mSettings->speed);
+    mPD3301->setVideoMode(mSettings->video);
 
     if (mUnit == EXP_UNIT_PC8012) {
         if (!mExtRAM) {
-            mExtRAM = (uint8_t *)ps_malloc(1024 * 128);
+            mExtRAM = (uint8_t *)PC80HAL::alloc(1024 * 128);
         }
         for (int i = 0; i < 0x20000; i += 4) *(uint32_t *)(mExtRAM + i) = 0xff00ff00;
 
-        mPD780C->setCallbacks(this, readBytePC8012, writeBytePC8012, readWordPC8012, writeWordPC8012, readIO, writeIO);
-    } else {
-        mPD780C->setCallbacks(this, readByte, writeByte, readWord, writeWord, readIO, writeIO);
     }
 
+    mPD780C->setCallbacks(this, readByte, writeByte, readWord, writeWord, readIO, writeIO);
+
     fontGen();
 
     reset();
@@ -122,6 +139,8 @@ void PC80VM::reset(void) {
     mPC80S31->reset();
     mKeyboard->reset();
 
+    mPC80S31->setDiskCache(mSettings->diskCache);
+    mPC80S31->setDiskOverlay(mSettings->diskOverlay);
     for (int i = 0; i < 4; i++) {
         if (strlen(mSettings->disk[i]) > 0) {
             mPC80S31->openDrive(i, mSettings->disk[i]);
@@ -142,6 +161,8 @@ void PC80VM::reset(void) {
 
     mMemMode = 0;
 
+    updateMemoryMap();
+
     mPD3301->reset();
     mPD3301->setPCG(mSettings->pcg);
 
@@ -159,6 +180,9 @@ void PC80VM::reset(void) {
     mPort40In |= 0x04;  // CMT
 
     mVRTC = false;
+
+    mFrameEnd = false;
+    mScheduler->schedule(mFrameEvent, mFrameCycles);
 }
 
 void PC80VM::run(void) {
@@ -170,7 +194,7 @@ void PC80VM::run(void) {
 
     init();
 
-    xTaskCreateUniversal(&pc80Task, "pc80Task", 4096, this, 1, &mTaskHandle, PRO_CPU_NUM);
+    mTaskHandle = PC80HAL::createTask(&pc80Task, "pc80Task", 4096, this, 1, HAL_CORE_VM);
 
     mPD8257->run();
     mKeyboard->run();
@@ -198,31 +222,120 @@ void IRAM_ATTR PC80VM::pc80Task(void *pvParameters) {
     vm->mPD780C->reset();
     vm->mPD780C->setPC(0);
 
-    int cycles = 0;
-    uint32_t previousTime = micros();
+    vm->mPD3301->setVSyncTask(xTaskGetCurrentTaskHandle());
+    vm->mKeyboard->setWakeTask(xTaskGetCurrentTaskHandle(), &vm->mIdle);
+    vm->clearIdle();
+
+#ifdef PC80_BENCHMARK
+    vm->mBenchTime = PC80HAL::micros();
+    vm->mBenchCycles = 0;
+    vm->mBenchFrames = 0;
+    vm->mBenchVideoFrames = vm->mPD3301->getFrameCounter();
+    vm->mBenchDisk = vm->mPC80S31->getTransferred();
+#endif
+
     while (true) {
         if (vm->mSuspending) {
             vm->vmControl(vm);
-            previousTime = micros();
-            cycles = 0;
+            vm->mPD3301->invalidate();  // memory may have been loaded directly (n80 file, BASIC on RAM)
         }
 
-        cycles += vm->mPD780C->step();
-        vm->mPD3301->updateVRAMcahce();
+        // Run a batch of instructions up to the next scheduled event; the bookkeeping below runs once per batch.
+        auto z80 = vm->mPD780C;
+        auto scheduler = vm->mScheduler;
+        int budget = scheduler->remaining();
+        if (budget > CPU_BATCH_CYCLES) budget = CPU_BATCH_CYCLES;
+        int batch = 0;
+        if (vm->mSettings->hle) {
+            do {
+                int pc = z80->getPC();
+                if (pc < HLE_TRAP_SIZE && (vm->mTrap[pc >> 5] & (1U << (pc & 0x1f))) && vm->isROM(pc)) {
+                    batch += vm->hleBlockTransfer(pc);
+                } else {
+                    batch += z80->step();
+                }
+            } while (batch < budget);
+        } else {
+            do {
+                batch += z80->step();
+            } while (batch < budget);
+        }
+        scheduler->advance(batch);
+#ifdef PC80_BENCHMARK
+        vm->benchmark(batch);
+#endif
 
-        if (!vm->mNoWait & cycles > 100) {
-            uint32_t currentTime = micros();
-            int diff = currentTime - previousTime;
-            if (diff < 0) diff = (0xFFFFFFFF - previousTime) + currentTime;
-            previousTime = currentTime;
+        // Idle detection: BASIC waiting for a key polls the keyboard ports from one small loop
+        // and changes no memory outside the stack (idleWrite).
+        int pc = z80->getPC();
+        if (vm->mIdlePC < 0) {
+            vm->mIdlePC = pc;
+        } else if (pc < vm->mIdlePC - IDLE_PC_WINDOW || vm->mIdlePC + IDLE_PC_WINDOW < pc) {
+            vm->mIdleBusy = true;
+        }
+        if (!vm->mIdleBusy && vm->mIdleReads >= IDLE_KEY_READS) {
+            // Nothing can change until a key is pressed: skip the rest of the frame.
+            vm->mIdle = true;
+            while (!vm->mFrameEnd) scheduler->skip();
+        }
 
-            int wait = (cycles - diff / 10) / vm->mWait;
-            if (wait > 0) delayMicroseconds(wait);
-            cycles = 0;
+        // Frame-locked throttling: run one frame worth of cycles, then sleep until the next VSync.
+        // While idle the VM sleeps even in no wait mode; a key press wakes it up early.
+        if (vm->mFrameEnd) {
+            vm->mFrameEnd = false;
+#ifdef PC80_BENCHMARK
+            vm->mBenchFrames++;
+#endif
+            // A VSync already pending here means the frame took longer than its time slot.
+            bool behind = true;
+            if (!vm->mNoWait || vm->mIdle) {
+                behind = !vm->mIdle && ulTaskNotifyTake(pdTRUE, 0) > 0;
+                if (!behind) ulTaskNotifyTake(pdTRUE, VSYNC_TIMEOUT);
+            }
+            vm->mPD3301->setCpuBehind(behind);
+            vm->clearIdle();
         }
     }
 }
 
+#ifdef PC80_BENCHMARK
+void PC80VM::benchmark(int cycles) {
+    mBenchCycles += cycles;
+
+    auto now = PC80HAL::micros();
+    uint32_t elapsed = now - mBenchTime;
+    if (elapsed < 1000000) return;
+
+    auto videoFrames = mPD3301->getFrameCounter();
+    auto disk = mPC80S31->getTransferred();
+    uint32_t mhz100 = (uint64_t)mBenchCycles * 100 / elapsed;
+
+    Serial.printf("Benchmark: %d.%02d MHz, guest %d fps, video %d fps, disk %d bytes/s, read-ahead %d hits %d misses\n", mhz100 / 100,
+                  mhz100 % 100, (int)((uint64_t)mBenchFrames * 1000000 / elapsed),
+                  (int)((uint64_t)(videoFrames - mBenchVideoFrames) * 1000000 / elapsed), (int)((uint64_t)(disk - mBenchDisk) * 1000000 / elapsed),
+                  mPC80S31->getReadAheadHits(), mPC80S31->getReadAheadMisses());
+
+    mBenchTime = now;
+    mBenchCycles = 0;
+    mBenchFrames = 0;
+    mBenchVideoFrames = videoFrames;
+    mBenchDisk = disk;
+}
+#endif
+
+void PC80VM::clearIdle(void) {
+    mIdle = false;
+    mIdleBusy = false;
+    mIdleReads = 0;
+    mIdlePC = -1;
+}
+
+void PC80VM::frameEvent(void *arg) {
+    auto vm = (PC80VM *)arg;
+    vm->mFrameEnd = true;
+    vm->mScheduler->schedule(vm->mFrameEvent, vm->mFrameCycles);
+}
+
 void PC80VM::suspend(bool suspend, bool pd3301) {
     mSuspending = suspend;
     mKeyboard->suspend(suspend);
@@ -230,390 +343,211 @@ void PC80VM::suspend(bool suspend, bool pd3301) {
     mPCG8100->suspend(suspend);
 }
 
-int IRAM_ATTR PC80VM::readWord(void *context, int addr) { return readByte(context, addr) | (readByte(context, addr + 1) << 8); }
+// Words inside one page are accessed directly; only even addresses may use a 16-bit load/store.
+int IRAM_ATTR PC80VM::readWord(void *context, int addr) {
+    auto vm = (PC80VM *)context;
+    auto offset = addr & PAGE_MASK;
+
+    if (offset != PAGE_MASK) {
+        auto p = vm->mReadPage[addr >> PAGE_SHIFT] + offset;
+        if (addr & 1) {
+            return p[0] | (p[1] << 8);
+        }
+        return *(uint16_t *)p;
+    }
+    return readByte(context, addr) | (readByte(context, (addr + 1) & 0xffff) << 8);
+}
 
 void IRAM_ATTR PC80VM::writeWord(void *context, int addr, int value) {
+    auto vm = (PC80VM *)context;
+    auto offset = addr & PAGE_MASK;
+    auto page = vm->mWritePage[addr >> PAGE_SHIFT];
+
+    if (page && offset != PAGE_MASK) {
+        auto p = page + offset;
+        if (!vm->mIdleBusy && (p[0] != (uint8_t)value || p[1] != (uint8_t)(value >> 8))) vm->idleWrite(addr);
+        if (addr & 1) {
+            p[0] = value;
+            p[1] = value >> 8;
+        } else {
+            *(uint16_t *)p = value;
+        }
+        vm->mPD3301->touchVRAM(addr);
+        vm->mPD3301->touchVRAM(addr + 1);
+        return;
+    }
     writeByte(context, addr, value & 0xFF);
-    writeByte(context, addr + 1, value >> 8);
+    writeByte(context, (addr + 1) & 0xffff, value >> 8);
 }
 
 int IRAM_ATTR PC80VM::readByte(void *context, int address) {
     auto vm = (PC80VM *)context;
 
-    int value;
-    if (address < 0x6000) {
-        value = vm->mRAM0000[address];
-    } else if (address < 0x8000) {
-        value = vm->mRAM6000[address - 0x6000];
-    } else {
-        value = vm->mRAM8000[address - 0x8000];
-    }
-
-    return value;
+    return vm->mReadPage[address >> PAGE_SHIFT][address & PAGE_MASK];
 }
 
 void IRAM_ATTR PC80VM::writeByte(void *context, int address, int value) {
     auto vm = (PC80VM *)context;
 
-    if (address < 0x6000) {
-        vm->mRAM[address] = value;
-    } else if (address < 0x8000) {
-        vm->mRAM[address] = value;
+    auto page = vm->mWritePage[address >> PAGE_SHIFT];
+    if (page) {
+        auto p = page + (address & PAGE_MASK);
+        if (!vm->mIdleBusy && *p != (uint8_t)value) vm->idleWrite(address);
+        *p = value;
+        vm->mPD3301->touchVRAM(address);
     } else {
-        vm->mRAM8000[address - 0x8000] = value;
+        if (!vm->mIdleBusy) vm->idleWrite(address);
+        writeBytePC8012(vm, address, value);
     }
 }
 
-int IRAM_ATTR PC80VM::readWordPC8012(void *context, int addr) {
-    return readBytePC8012(context, addr) | (readBytePC8012(context, addr + 1) << 8);
+// PC-8012 writes to every bank selected by port E2h bit 4-7.
+void IRAM_ATTR PC80VM::writeBytePC8012(PC80VM *vm, int address, int value) {
+    if (vm->mPortE2 & 0x10) {
+        vm->mExtRAM[address] = value;
+    }
+    if (vm->mPortE2 & 0x20) {
+        vm->mExtRAM[address + 0x8000] = value;
+    }
+    if (vm->mPortE2 & 0x40) {
+        vm->mExtRAM[address + 0x10000] = value;
+    }
+    if (vm->mPortE2 & 0x80) {
+        vm->mExtRAM[address + 0x18000] = value;
+    }
 }
 
-void IRAM_ATTR PC80VM::writeWordPC8012(void *context, int addr, int value) {
-    writeBytePC8012(context, addr, value & 0xFF);
-    writeBytePC8012(context, addr + 1, value >> 8);
-}
+void PC80VM::updateMemoryMap(void) {
+    for (int i = 0; i < PAGES; i++) {
+        int address = i << PAGE_SHIFT;
+        if (address < 0x6000) {
+            mReadPage[i] = mRAM0000 + address;
+            mWritePage[i] = mRAM + address;
+        } else if (address < 0x8000) {
+            mReadPage[i] = mRAM6000 + address - 0x6000;
+            mWritePage[i] = mRAM + address;
+        } else {
+            mReadPage[i] = mRAM8000 + address - 0x8000;
+            mWritePage[i] = mRAM8000 + address - 0x8000;
+        }
+    }
 
-int IRAM_ATTR PC80VM::readBytePC8012(void *context, int address) {
-    auto vm = (PC80VM *)context;
+    if (mUnit == EXP_UNIT_PC8012) updateMemoryMapPC8012();
 
-    int value;
-    if (address < 0x6000) {
-        if ((vm->mPortE2 & 0x0f) == 0) {
-            value = vm->mRAM0000[address];
-        } else if (vm->mPortE2 & 0x01) {
-            value = vm->mExtRAM[address];
-        } else if (vm->mPortE2 & 0x02) {
-            value = vm->mExtRAM[address + 0x8000];
-        } else if (vm->mPortE2 & 0x04) {
-            value = vm->mExtRAM[address + 0x10000];
-        } else if (vm->mPortE2 & 0x08) {
-            value = vm->mExtRAM[address + 0x18000];
+    // Pages currently executing from ROM; rebuilt on every bank switch (E0h-E3h).
+    mROMPages = 0;
+    for (int i = 0; i < PAGES; i++) {
+        auto page = mReadPage[i];
+        if ((mBasicROM <= page && page < mBasicROM + 0x6000) || (mUserROM <= page && page < mUserROM + 0x2000)) {
+            mROMPages |= 1ULL << i;
         }
-    } else if (address < 0x8000) {
-        if ((vm->mPortE2 & 0x0f) == 0) {
-            value = vm->mRAM6000[address - 0x6000];
-        } else if (vm->mPortE2 & 0x01) {
-            value = vm->mExtRAM[address];
-        } else if (vm->mPortE2 & 0x02) {
-            value = vm->mExtRAM[address + 0x8000];
-        } else if (vm->mPortE2 & 0x04) {
-            value = vm->mExtRAM[address + 0x10000];
-        } else if (vm->mPortE2 & 0x08) {
-            value = vm->mExtRAM[address + 0x18000];
-        }
-    } else {
-        value = vm->mRAM8000[address - 0x8000];
     }
-
-    return value;
 }
 
-void IRAM_ATTR PC80VM::writeBytePC8012(void *context, int address, int value) {
-    auto vm = (PC80VM *)context;
-
-    if (address < 0x8000) {
-        if (vm->mPortE2 & 0x10) {
-            vm->mExtRAM[address] = value;
-        }
-        if (vm->mPortE2 & 0x20) {
-            vm->mExtRAM[address + 0x8000] = value;
+// PC-8012: port E2h bit 0-3 select the read bank and bit 4-7 the write banks of 0000h-7fffh.
+void PC80VM::updateMemoryMapPC8012(void) {
+    for (int bank = 0; bank < 4; bank++) {
+        if (mPortE2 & (0x01 << bank)) {
+            for (int i = 0; i < (0x8000 >> PAGE_SHIFT); i++) {
+                mReadPage[i] = mExtRAM + bank * 0x8000 + (i << PAGE_SHIFT);
+            }
+            break;
         }
-        if (vm->mPortE2 & 0x40) {
-            vm->mExtRAM[address + 0x10000] = value;
+    }
+
+    int banks = 0;
+    uint8_t *writeBank = nullptr;
+    for (int bank = 0; bank < 4; bank++) {
+        if (mPortE2 & (0x10 << bank)) {
+            writeBank = mExtRAM + bank * 0x8000;
+            banks++;
         }
-        if (vm->mPortE2 & 0x80) {
-            vm->mExtRAM[address + 0x18000] = value;
+    }
+    for (int i = 0; i < (0x8000 >> PAGE_SHIFT); i++) {
+        if (banks == 0) {
+            mWritePage[i] = mDummyPage;
+        } else if (banks == 1) {
+            mWritePage[i] = writeBank + (i << PAGE_SHIFT);
+        } else {
+            mWritePage[i] = nullptr;
         }
-    } else {
-        vm->mRAM8000[address - 0x8000] = value;
     }
 }
 
-int PC80VM::readIO(void *context, int address) {
-    auto vm = (PC80VM *)context;
-    auto pc = vm->mPD780C->getPC();
-
-    switch (address & 0xff) {
-        case 0x00:
-            return vm->mKeyMap[0];
-        case 0x01:
-            return vm->mKeyMap[1];
-        case 0x02:
-            return vm->mKeyMap[2];
-        case 0x03:
-            return vm->mKeyMap[3];
-        case 0x04:
-            return vm->mKeyMap[4];
-        case 0x05:
-            return vm->mKeyMap[5];
-        case 0x06:
-            return vm->mKeyMap[6];
-        case 0x07:
-            return vm->mKeyMap[7];
-        case 0x08:
-            return vm->mKeyMap[8];
-        case 0x09:
-            return vm->mKeyMap[9];
-        case 0x20:
-        case 0x22:
-        case 0x24:
-        case 0x26:
-        case 0x28:
-        case 0x2a:
-        case 0x2c:
-        case 0x2e:
-            return vm->mDR320->readData();
-        case 0x21:
-        case 0x23:
-        case 0x25:
-        case 0x27:
-        case 0x29:
-        case 0x2b:
-        case 0x2d:
-        case 0x2f:
-            return vm->mDR320->readStatus();
-        case 0x30:
-        case 0x31:
-        case 0x32:
-        case 0x33:
-        case 0x34:
-        case 0x35:
-        case 0x36:
-        case 0x37:
-        case 0x38:
-        case 0x39:
-        case 0x3a:
-        case 0x3b:
-        case 0x3c:
-        case 0x3d:
-        case 0x3e:
-        case 0x3f:
-            return vm->mPort30;
-        case 0x40:
-        case 0x41:
-        case 0x42:
-        case 0x43:
-        case 0x44:
-        case 0x45:
-        case 0x46:
-        case 0x47:
-        case 0x48:
-        case 0x49:
-        case 0x4a:
-        case 0x4b:
-        case 0x4c:
-        case 0x4d:
-        case 0x4e:
-        case 0x4f:
-            // VRTC is updated in PD3301::drawScanline.
-            vm->mPort40In = (vm->mPort40In & 0xef) | vm->mPD1990->read();  // PD1990 calender clock
-            return vm->mPort40In;
-        case 0x50:
-            return vm->mPD3301->inPort50();
-        case 0x51:
-            return vm->mPD3301->inPort51();
-        case 0x68:
-            return vm->mPD8257->inPort68();
-        case 0xe2:
-            return ~vm->mPortE2;
-            break;
-        case 0xfc:  // Mini disk unit Port A
-            return vm->mI8255->in(I8255_PORT_A);
-        case 0xfd:  // Mini disk unit Port B
-            return vm->mI8255->in(I8255_PORT_B);
-        case 0xfe:  // Mini disk unit Port C
-            return vm->mI8255->in(I8255_PORT_C);
-        case 0xff:  // Mini disk unit control port
-            return vm->mI8255->in(I8255_PORT_CONTROL);
-        default:
-#ifdef DEBUG_PC80VM
-            Serial.printf("Read non-implemeted port %02x\n", address);
-#endif
-            return 0;
+int IRAM_ATTR PC80VM::readIO(void *context, int address) { return ((PC80VM *)context)->mIO->in(address); }
+
+void IRAM_ATTR PC80VM::writeIO(void *context, int address, int value) { ((PC80VM *)context)->mIO->out(address, value); }
+
+// Ports owned by the VM itself; the other devices register their own ports.
+void PC80VM::initIO(void) {
+    mIO->setIn(0x00, 0x09, ioInKeyboard, this);
+    mIO->setIn(0x30, 0x3f, ioIn30, this);
+    mIO->setOut(0x30, 0x3f, ioOut30, this);
+    mIO->setIn(0x40, 0x4f, ioIn40, this);
+    mIO->setOut(0x40, 0x4f, ioOut40, this);
+    mIO->setIn(0xe2, 0xe2, ioInE2, this);
+    mIO->setOut(0xe0, 0xe0, ioOutE0, this);  // PC-8011 mode 0
+    mIO->setOut(0xe2, 0xe2, ioOutE2, this);
+    mIO->setOut(0xe3, 0xe3, ioOutE0, this);  // PC-8011 mode 3 (as same as mode 0)
+}
+
+int PC80VM::ioInKeyboard(void *arg, int port) {
+    auto vm = (PC80VM *)arg;
+    auto value = vm->mKeyMap[port];
+    if (value == 0xff) {
+        vm->mIdleReads++;
+    } else {
+        vm->mIdleBusy = true;
     }
-    return 0;
+    return value;
 }
 
-void PC80VM::writeIO(void *context, int address, int value) {
-    auto vm = (PC80VM *)context;
+int PC80VM::ioIn30(void *arg, int port) { return ((PC80VM *)arg)->mPort30; }
 
-    switch (address & 0xff) {
-        case 0x00:
-            vm->mPCG8100->port00(value);
-            break;
-        case 0x01:
-            vm->mPCG8100->port01(value);
-            break;
-        case 0x02:
-            vm->mPCG8100->port02(value);
-            break;
-        case 0x0c:
-            vm->mPCG8100->port0c(value);
-            break;
-        case 0x0d:
-            vm->mPCG8100->port0d(value);
-            break;
-        case 0x0e:
-            vm->mPCG8100->port0e(value);
-            break;
-        case 0x0f:
-            vm->mPCG8100->port0f(value);
-            break;
-        case 0x10:
-        case 0x11:
-        case 0x12:
-        case 0x13:
-        case 0x14:
-        case 0x15:
-        case 0x16:
-        case 0x17:
-        case 0x18:
-        case 0x19:
-        case 0x1a:
-        case 0x1b:
-        case 0x1c:
-        case 0x1d:
-        case 0x1e:
-        case 0x1f:
-            vm->mPD1990->write(0x10, value);
-            break;
-        case 0x20:
-        case 0x22:
-        case 0x24:
-        case 0x26:
-        case 0x28:
-        case 0x2a:
-        case 0x2c:
-        case 0x2e:
-            vm->mDR320->writeData(value);
-            break;
-        case 0x21:
-        case 0x23:
-        case 0x25:
-        case 0x27:
-        case 0x29:
-        case 0x2b:
-        case 0x2d:
-        case 0x2f:
-            vm->mDR320->modeCommand(value);
-            break;
-        case 0x30:
-        case 0x31:
-        case 0x32:
-        case 0x33:
-        case 0x34:
-        case 0x35:
-        case 0x36:
-        case 0x37:
-        case 0x38:
-        case 0x39:
-        case 0x3a:
-        case 0x3b:
-        case 0x3c:
-        case 0x3d:
-        case 0x3e:
-        case 0x3f:
-            vm->mPort30 = value & 0xff;
-            vm->mColumn80 = value & 0x01;
-            vm->mPD3301->setCloumn80(vm->mColumn80);
-            vm->mDR320->systemControl(value);
-            break;
-        case 0x40:
-        case 0x41:
-        case 0x42:
-        case 0x43:
-        case 0x44:
-        case 0x45:
-        case 0x46:
-        case 0x47:
-        case 0x48:
-        case 0x49:
-        case 0x4a:
-        case 0x4b:
-        case 0x4c:
-        case 0x4d:
-        case 0x4e:
-        case 0x4f:
-            vm->mPCG8100->beep(value & 0x20);
-            vm->mPD1990->write(0x40, value);
-            vm->mPort40Out = value;
-            break;
-        case 0x50:
-            vm->mPD3301->crtcData(value);
-            break;
-        case 0x51:
-            vm->mPD3301->crtcCmd(value);
-            break;
-        case 0x60:
-            vm->mPD8257->dmaAddress(0, value);
-            break;
-        case 0x61:
-            vm->mPD8257->dmaTerminalCount(0, value);
-            break;
-        case 0x62:
-            vm->mPD8257->dmaAddress(1, value);
-            break;
-        case 0x63:
-            vm->mPD8257->dmaTerminalCount(1, value);
-            break;
-        case 0x64:
-            vm->mPD8257->dmaAddress(2, value);
-            break;
-        case 0x65:
-            vm->mPD8257->dmaTerminalCount(2, value);
-            break;
-        case 0x66:
-            vm->mPD8257->dmaAddress(3, value);
-            break;
-        case 0x67:
-            vm->mPD8257->dmaTerminalCount(3, value);
-            break;
-        case 0x68:
-            vm->mPD8257->dmaCmd(value);
-            break;
-        case 0xe0:  // PC-8011 mode 0
-            if (vm->mUnit == EXP_UNIT_PC8011) {
-                vm->mRAM0000 = vm->mBasicROM;
-                vm->mRAM6000 = vm->mUserROM;
-                vm->mMemMode = 0;
-            }
-            break;
-        case 0xe1:  // PC-8011 mode 1 (no effect)
-            // vm->mMemMode = 1;
-            break;
-        case 0xe2:
-            if (vm->mUnit == EXP_UNIT_PC8011) {  // PC-8011 mode 2
-                vm->mRAM0000 = vm->mRAM;
-                vm->mRAM6000 = vm->mRAM + 0x6000;
-                vm->mMemMode = 2;
-            } else if (vm->mUnit == EXP_UNIT_PC8012) {
-                vm->mPortE2 = value;
-            }
-            break;
-        case 0xe3:  // PC-8011 mode 3 (as same as mode 0)
-            if (vm->mUnit == EXP_UNIT_PC8011) {
-                vm->mRAM0000 = vm->mBasicROM;
-                vm->mRAM6000 = vm->mUserROM;
-                vm->mMemMode = 0;
-            }
-            break;
-        case 0xfc:  // Mini disk unit Port A
-            vm->mI8255->out(I8255_PORT_A, value & 0xff);
-            break;
-        case 0xfd:  // Mini disk unit Port B
-            vm->mI8255->out(I8255_PORT_B, value & 0xff);
-            break;
-        case 0xfe:  // Mini disk unit Port C
-            vm->mI8255->out(I8255_PORT_C, value & 0xff);
-            break;
-        case 0xff:  // Mini disk unit control port
-            vm->mI8255->out(I8255_PORT_CONTROL, value & 0xff);
-            break;
-        default:
-#ifdef DEBUG_PC80VM
-            Serial.printf("Write non-implemeted port %02x %02x\n", address, value);
-#endif
-            break;
+void PC80VM::ioOut30(void *arg, int port, int value) {
+    auto vm = (PC80VM *)arg;
+    vm->mPort30 = value & 0xff;
+    vm->mColumn80 = value & 0x01;
+    vm->mPD3301->setCloumn80(vm->mColumn80);
+    vm->mDR320->systemControl(value);
+}
+
+int PC80VM::ioIn40(void *arg, int port) {
+    auto vm = (PC80VM *)arg;
+    // VRTC is updated by the PD3301 scheduler event.
+    vm->mPort40In = (vm->mPort40In & 0xef) | vm->mPD1990->read();  // PD1990 calender clock
+    return vm->mPort40In;
+}
+
+void PC80VM::ioOut40(void *arg, int port, int value) {
+    auto vm = (PC80VM *)arg;
+    vm->mPCG8100->beep(value & 0x20);
+    vm->mPD1990->write(0x40, value);
+    vm->mPort40Out = value;
+}
+
+int PC80VM::ioInE2(void *arg, int port) { return ~((PC80VM *)arg)->mPortE2; }
+
+void PC80VM::ioOutE0(void *arg, int port, int value) {
+    auto vm = (PC80VM *)arg;
+    if (vm->mUnit == EXP_UNIT_PC8011) {
+        vm->mRAM0000 = vm->mBasicROM;
+        vm->mRAM6000 = vm->mUserROM;
+        vm->mMemMode = 0;
+        vm->updateMemoryMap();
+    }
+}
+
+void PC80VM::ioOutE2(void *arg, int port, int value) {
+    auto vm = (PC80VM *)arg;
+    if (vm->mUnit == EXP_UNIT_PC8011) {  // PC-8011 mode 2
+        vm->mRAM0000 = vm->mRAM;
+        vm->mRAM6000 = vm->mRAM + 0x6000;
+        vm->mMemMode = 2;
+        vm->updateMemoryMap();
+    } else if (vm->mUnit == EXP_UNIT_PC8012) {
+        vm->mPortE2 = value;
+        vm->updateMemoryMap();
     }
 }
 
@@ -622,6 +556,7 @@ void PC80VM::vmControl(PC80VM *vm) {
 
     if (cmd == CMD_PC80MENU) {
         vm->suspend(true);
+        vm->mPC80S31->flush();  // disk images on the SD card are up to date while in the menu
         cmd = vm->mPC80MENU->menu(vm);
         vm->suspend(false);
         if (cmd == -1) return;
@@ -711,11 +646,11 @@ int PC80VM::initFileSystem(void) {
         return -1;
     }
 
-    const char *dirName[3] = {PC80DIR_DISK, PC80DIR_TAPE, PC80DIR_N80};
+    const char *dirName[4] = {PC80DIR_DISK, PC80DIR_TAPE, PC80DIR_N80, PC80DIR_SCREEN};
 
     FileBrowser dir(mRootDir);
 
-    for (int i = 0; i < 3; i++) {
+    for (int i = 0; i < 4; i++) {
         char name[32];
         strcpy(&name[0], dirName[i]);
         if (!dir.exists(&name[1])) {
@@ -754,14 +689,71 @@ int PC80VM::initMemory(void) {
 
     mExtRAM = nullptr;
 
+    mDummyPage = lalloc(PAGE_SIZE, true);
+
     return 0;
 }
 
+// High-level emulation: LDIR / LDDR in ROM (screen scroll, block moves) run natively.
+// The trap table is built from the loaded ROM images, so it always matches them.
+int PC80VM::initHLE(void) {
+    mTrap = (uint32_t *)lalloc(HLE_TRAP_SIZE / 8, true);
+    memset(mTrap, 0, HLE_TRAP_SIZE / 8);
+
+    int traps = 0;
+    for (int address = 0; address < HLE_TRAP_SIZE - 1; address++) {
+        if (address == 0x5fff) continue;  // crosses from BASIC ROM into user ROM
+        auto rom = address < 0x6000 ? mBasicROM + address : mUserROM + address - 0x6000;
+        if (rom[0] == 0xed && (rom[1] == 0xb0 || rom[1] == 0xb8)) {
+            mTrap[address >> 5] |= 1U << (address & 0x1f);
+            traps++;
+        }
+    }
+
+#ifdef DEBUG_PC80VM
+    Serial.printf("HLE: %d traps\n", traps);
+#endif
+    return traps;
+}
+
+// Execute LDIR / LDDR at pc in one go. Registers, flags and memory end up as on a Z80;
+// the refresh register is not advanced.
+int IRAM_ATTR PC80VM::hleBlockTransfer(int pc) {
+    auto z80 = mPD780C;
+    int step = readByte(this, (pc + 1) & 0xffff) == 0xb0 ? 1 : -1;
+
+    int hl = z80->readRegWord(Z80_HL);
+    int de = z80->readRegWord(Z80_DE);
+    int bc = z80->readRegWord(Z80_BC);
+    int count = bc ? bc : 0x10000;
+
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        value = readByte(this, hl);
+        writeByte(this, de, value);
+        hl = (hl + step) & 0xffff;
+        de = (de + step) & 0xffff;
+    }
+
+    // S, Z and C are kept; H, P/V and N are reset; bit 3 and 5 come from (A + last byte).
+    int n = z80->readRegByte(Z80_A) + value;
+    int f = (z80->readRegByte(Z80_F) & 0xc1) | (n & 0x08) | ((n & 0x02) << 4);
+
+    z80->writeRegWord(Z80_HL, hl);
+    z80->writeRegWord(Z80_DE, de);
+    z80->writeRegWord(Z80_BC, 0);
+    z80->writeRegByte(Z80_F, f);
+    z80->setPC((pc + 2) & 0xffff);
+
+    return count * 21 - 5;
+}
+
 int PC80VM::initFont(void) {
     auto font = lalloc(2048, false, "PC-8001.FON");
 
-    mFontROM = lalloc(10 * 256 * 3 * 3, true);
-    memset(mFontROM, 0, 10 * 256 * 3 * 3);
+    // 80 columns: normal, PCG; 40 columns (doubled width): normal, PCG. Graphic cells are drawn by PD3301 directly.
+    mFontROM = lalloc(10 * 256 * 6, true);
+    memset(mFontROM, 0, 10 * 256 * 6);
 
     auto src = font;
     auto dest = mFontROM;
@@ -783,26 +775,11 @@ int PC80VM::initFont(void) {
 void PC80VM::fontGen(void) {
     static uint8_t fontConv[16] = {0x00, 0x03, 0x0c, 0x0f, 0x30, 0x33, 0x3c, 0x3f, 0xc0, 0xc3, 0xcc, 0xcf, 0xf0, 0xf3, 0xfc, 0xff};
 
-    auto p = mFontROM + 10 * 256;
-    for (int i = 0; i < 256; i++) {
-        for (int j = 0; j < 4; j++) {
-            if ((i >> j) & 0x01) {
-                *(p + j * 2) |= 0xf0;
-                *(p + j * 2 + 1) |= 0xf0;
-            }
-            if ((i >> (j + 4)) & 0x01) {
-                *(p + j * 2) |= 0x0f;
-                *(p + j * 2 + 1) |= 0x0f;
-            }
-        }
-        p += 10;
-    }
-
-    memcpy(mFontROM + (10 * 256) * 2, mFontROM, 10 * 256);
+    memcpy(mFontROM + 10 * 256, mFontROM, 10 * 256);
 
     auto src = mFontROM;
-    auto dest = mFontROM + (10 * 256) * 3;
-    for (int i = 0; i < 256 * 3; i++) {
+    auto dest = mFontROM + (10 * 256) * 2;
+    for (int i = 0; i < 256 * 2; i++) {
         for (int j = 0; j < 10; j++) {
             *(dest + j) = fontConv[(*(src + j) & 0xf0) >> 4];
             *(dest + j + 10) = fontConv[(*(src + j) & 0x0f)];
@@ -833,7 +810,7 @@ int PC80VM::initDisk(void) {
 // load file with memory allocation
 
 uint8_t *PC80VM::lalloc(size_t size, bool internal, const char *fileName, bool require) {
-    auto mem = (uint8_t *)(internal ? heap_caps_malloc(size, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL) : ps_malloc(size));
+    auto mem = (uint8_t *)(internal ? PC80HAL::allocInternal(size) : PC80HAL::alloc(size));
     if (!mem) {
         PC80ERROR::dialog("Memory allocation error");
         return nullptr;
@@ -902,45 +879,28 @@ uint8_t *PC80VM::lalloc(size_t size, bool internal, const char *fileName, bool r
 
 void PC80VM::setVolume(int value) { mPCG8100->setVolume(value); }
 
+int PC80VM::getCpuSpeedPercent(int speed) {
+    static const int percent[10] = {0, 400, 200, 150, 125, 100, 80, 60, 40, 20};
+
+    if (CPU_SPEED_NO_WAIT <= speed && speed <= CPU_SPEED_VERY_VERY_SLOW) {
+        return percent[speed];
+    }
+    return 100;
+}
+
 void PC80VM::setCpuSpeed(int speed) {
-    mNoWait = false;
     mSettings->speed = speed;
 
-    switch ((speed)) {
-        case CPU_SPEED_NO_WAIT:
-            mNoWait = true;
-            break;
-        case CPU_SPEED_VERY_VERY_FAST:
-            mWait = 22;
-            break;
-        case CPU_SPEED_VERY_FAST:
-            mWait = 13;
-            break;
-        case CPU_SPEED_FAST:
-            mWait = 9;
-            break;
-        case CPU_SPEED_A_LITTLE_FAST:
-            mWait = 7;
-            break;
-        case CPU_SPEED_NORMAL:
-            mWait = 6;
-            break;
-        case CPU_SPEED_A_LITTLE_SLOW:
-            mWait = 5;
-            break;
-        case CPU_SPEED_SLOW:
-            mWait = 4;
-            break;
-        case CPU_SPEED_VERY_SLOW:
-            mWait = 3;
-            break;
-        case CPU_SPEED_VERY_VERY_SLOW:
-            mWait = 2;
-            break;
-        default:
-            mWait = 6;
-            break;
+    if (speed == CPU_SPEED_NO_WAIT) {
+        mNoWait = true;
+        mFrameCycles = CPU_CLOCK / FRAME_RATE;
+    } else {
+        mFrameCycles = CPU_CLOCK / 100 * getCpuSpeedPercent(speed) / FRAME_RATE;
+        mNoWait = false;
     }
+
+    // Guest VRTC follows the emulated clock rate; the calendar clock (PD1990) stays in real time.
+    mPD3301->setFrameCycles(mFrameCycles);
 }
 
 void PC80VM::esp32Restart(PC80VM *vm) {
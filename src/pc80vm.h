@@ -32,8 +32,11 @@
 #include "fabutils.h"
 #include "i8255.h"
 #include "pc80keyboard.h"
+#include "pc80hal.h"
+#include "pc80io.h"
 #include "pc80menu.h"
 #include "pc80s31.h"
+#include "pc80scheduler.h"
 #include "pc80settings.h"
 #include "pcg8100.h"
 #include "pd1990.h"
@@ -45,6 +48,7 @@
 #define PC80DIR_DISK "/disk"
 #define PC80DIR_TAPE "/tape"
 #define PC80DIR_N80 "/n80"
+#define PC80DIR_SCREEN "/screen"
 
 #define CMD_PC80MENU (0x1000)
 #define CMD_HOT_START (0x1001)
@@ -73,6 +77,23 @@
 #define CPU_SPEED_VERY_SLOW (8)
 #define CPU_SPEED_VERY_VERY_SLOW (9)
 
+#define CPU_CLOCK (4000000)
+#define FRAME_RATE (60)
+
+// Idle detection (per frame)
+#define IDLE_KEY_READS (256)     // keyboard port reads with no key down
+#define IDLE_PC_WINDOW (0x100)  // batch end PCs must stay this close together
+#define IDLE_STACK_WINDOW (0x20)  // writes this close to SP are calls and pushes of the polling loop
+
+// Memory map
+#define PAGE_SHIFT (10)
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define PAGE_MASK (PAGE_SIZE - 1)
+#define PAGES (0x10000 >> PAGE_SHIFT)
+
+// High-level emulation traps (BASIC ROM and user ROM)
+#define HLE_TRAP_SIZE (0x8000)
+
 typedef struct {
     int cmd;
     int data;
@@ -100,12 +121,6 @@ class PC80VM {
     static int readWord(void *context, int addr);
     static void writeWord(void *context, int addr, int value);
 
-    static int readBytePC8012(void *context, int address);
-    static void writeBytePC8012(void *context, int address, int value);
-
-    static int readWordPC8012(void *context, int addr);
-    static void writeWordPC8012(void *context, int addr, int value);
-
     static int readIO(void *context, int address);
     static void writeIO(void *context, int address, int value);
 
@@ -127,6 +142,7 @@ class PC80VM {
     void setVolume(int value);
     void vmControl(PC80VM *vm);
     void setCpuSpeed(int speed);
+    static int getCpuSpeedPercent(int speed);
 
    private:
     PC80KeyBoard *mKeyboard;
@@ -141,6 +157,11 @@ class PC80VM {
 
     PC80MENU *mPC80MENU;
 
+    PC80SCHEDULER *mScheduler;
+    PC80IO *mIO;
+    int mFrameEvent;
+    volatile bool mFrameEnd;
+
     TaskHandle_t mTaskHandle;
 
     uint8_t *mRAM0000;
@@ -160,6 +181,14 @@ class PC80VM {
 
     uint8_t *mExtRAM;
 
+    // Page table (1KB pages), rebuilt by updateMemoryMap
+    uint8_t *mReadPage[PAGES];
+    uint8_t *mWritePage[PAGES];  // nullptr: PC-8012 multi-bank write
+    uint8_t *mDummyPage;
+    uint64_t mROMPages;  // bit n: page n is mapped to BASIC ROM or user ROM
+
+    uint32_t *mTrap;  // bit per ROM address: LDIR / LDDR to run natively
+
     bool mHasUserROM;
 
     PC80SETTINGS *mPC80Settings;
@@ -169,6 +198,7 @@ class PC80VM {
 
     fabgl::Z80 *mPD780C;
     static void pc80Task(void *pvParameters);
+    static void frameEvent(void *arg);
 
     // Port 30h
     uint8_t mPort30;
@@ -191,9 +221,29 @@ class PC80VM {
 
     int mKbCmd;
 
-    volatile int mWait;
+    volatile int mFrameCycles;  // CPU cycles per 60Hz frame at the current speed
     volatile bool mNoWait;
 
+    volatile bool mIdle;
+    bool mIdleBusy;
+    int mIdleReads;
+    int mIdlePC;
+    void clearIdle(void);
+
+    // A write that changes memory outside the stack means the polling loop is doing real work.
+    inline void idleWrite(int address) {
+        if ((unsigned)(address - mPD780C->readRegWord(Z80_SP) + IDLE_STACK_WINDOW) >= 2 * IDLE_STACK_WINDOW) mIdleBusy = true;
+    }
+
+#ifdef PC80_BENCHMARK
+    uint32_t mBenchTime;
+    uint32_t mBenchCycles;
+    uint32_t mBenchFrames;
+    uint32_t mBenchVideoFrames;
+    uint32_t mBenchDisk;
+    void benchmark(int cycles);
+#endif
+
     void memDump(uint8_t *mRAM, int address, int offset);
 
     int init(void);
@@ -202,9 +252,26 @@ class PC80VM {
     int initMemory(void);
     int initFont(void);
     int initDisk(void);
+    int initHLE(void);
+    int hleBlockTransfer(int pc);
 
     void fontGen(void);
 
+    void initIO(void);
+    static int ioInKeyboard(void *arg, int port);
+    static int ioIn30(void *arg, int port);
+    static void ioOut30(void *arg, int port, int value);
+    static int ioIn40(void *arg, int port);
+    static void ioOut40(void *arg, int port, int value);
+    static int ioInE2(void *arg, int port);
+    static void ioOutE0(void *arg, int port, int value);
+    static void ioOutE2(void *arg, int port, int value);
+
+    void updateMemoryMap(void);
+    void updateMemoryMapPC8012(void);
+    inline bool isROM(int address) { return (mROMPages >> (address >> PAGE_SHIFT)) & 1; }
+    static void writeBytePC8012(PC80VM *vm, int address, int value);
+
     uint8_t *lalloc(size_t size, bool internal = false, const char *fileName = nullptr, bool require = true);
     int getAddress(char *p);
     void coldBoot(void);
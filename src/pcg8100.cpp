@@ -2,6 +2,8 @@
 
 #include <Arduino.h>
 
+#include "pc80vm.h"
+
 #ifdef DEBUG_PC80
 // #define DEBUG_PCG8100
 #endif
@@ -38,12 +40,14 @@ PCG8100::~PCG8100() {}
 
 const uint8_t PCG8100::mVolume[16] = {0, 8, 17, 25, 34, 42, 51, 59, 68, 76, 85, 93, 102, 110, 119, 127};
 
-void PCG8100::init(uint8_t *fontROM, int volume) {
+void PCG8100::init(uint8_t *fontROM, int volume, PD3301 *pd3301) {
+    mPD3301 = pd3301;
+
     mFontROM80 = fontROM;
-    mFontROM80PCG = fontROM + 0x1400;
+    mFontROM80PCG = fontROM + 0xa00;
 
-    mFontROM40 = fontROM + 0x1e00;
-    mFontROM40PCG = fontROM + 0x1e00 + 0x2800;
+    mFontROM40 = fontROM + 0x1400;
+    mFontROM40PCG = fontROM + 0x1400 + 0x1400;
 
     mSoundMute = false;
 
@@ -93,6 +97,20 @@ void PCG8100::enable(int value, bool status) {
     mSquareWaveformGenerator[value]->enable(status);
 }
 
+void PCG8100::registerIO(PC80IO *io) {
+    io->setOut(0x00, 0x00, ioOut00, this);
+    io->setOut(0x01, 0x01, ioOut01, this);
+    io->setOut(0x02, 0x02, ioOut02, this);
+    io->setOut(0x0c, 0x0e, ioOutCounter, this);
+    io->setOut(0x0f, 0x0f, ioOut0f, this);
+}
+
+void PCG8100::ioOut00(void *arg, int port, int value) { ((PCG8100 *)arg)->port00(value); }
+void PCG8100::ioOut01(void *arg, int port, int value) { ((PCG8100 *)arg)->port01(value); }
+void PCG8100::ioOut02(void *arg, int port, int value) { ((PCG8100 *)arg)->port02(value); }
+void PCG8100::ioOutCounter(void *arg, int port, int value) { ((PCG8100 *)arg)->setCounter(port - 0x0c, value); }
+void PCG8100::ioOut0f(void *arg, int port, int value) { ((PCG8100 *)arg)->port0f(value); }
+
 void PCG8100::port00(uint8_t value) { mPCGData = value; }
 void PCG8100::port01(uint8_t value) { mPCGAddr = (mPCGAddr & 0xff00) | value; }
 void PCG8100::port02(uint8_t value) {
@@ -118,6 +136,7 @@ void PCG8100::port02(uint8_t value) {
             *(mFontROM40PCG + offset) = fontConv[(mPCGData & 0xf0) >> 4];
             *(mFontROM40PCG + offset + 10) = fontConv[(mPCGData & 0x0f)];
         }
+        mPD3301->fontChanged();
     }
     mBit4 = curBit4;
     mBit5 = curBit5;
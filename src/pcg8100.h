@@ -5,13 +5,16 @@
 #include <cstdint>
 
 #include "fabgl.h"
+#include "pc80io.h"
+
+class PD3301;
 
 class PCG8100 {
    public:
     PCG8100();
     ~PCG8100();
 
-    void init(uint8_t *fontROM, int volume);
+    void init(uint8_t *fontROM, int volume, PD3301 *pd3301);
     void reset(void);
 
     void port00(uint8_t value);
@@ -22,6 +25,8 @@ class PCG8100 {
     void port0e(uint8_t value);
     void port0f(uint8_t value);
 
+    void registerIO(PC80IO *io);
+
     void suspend(bool value);
     void beep(bool value);
     void soundMute(void);
@@ -32,6 +37,14 @@ class PCG8100 {
     void volumeDown(void);
 
    private:
+    PD3301 *mPD3301;
+
+    static void ioOut00(void *arg, int port, int value);
+    static void ioOut01(void *arg, int port, int value);
+    static void ioOut02(void *arg, int port, int value);
+    static void ioOutCounter(void *arg, int port, int value);
+    static void ioOut0f(void *arg, int port, int value);
+
     uint8_t *mFontROM80;
     uint8_t *mFontROM80PCG;
     uint8_t *mFontROM40;
@@ -42,10 +42,17 @@ PD1990::PD1990() {
     mCSTB = false;
     mCCK = false;
     mShift = false;
+    mTimeOffset = 0;
 }
 
 PD1990::~PD1990() {}
 
+
+// Port 10h-1Fh; port 40h (strobe, clock) is shared with other devices and handled by the VM.
+void PD1990::registerIO(PC80IO *io) { io->setOut(0x10, 0x1f, ioOutCmd, this); }
+
+void PD1990::ioOutCmd(void *arg, int port, int value) { ((PD1990 *)arg)->write(0x10, value); }
+
 uint8_t PD1990::read(void) { return mOutData & 0x01 ? PD1990_CDI : 0; }
 
 #define PD1990_CSTB (0x02)
@@ -113,22 +120,20 @@ void PD1990::clockSTB(void) {
     }
 }
 
+// The calendar runs in real time whatever the CPU speed, also while the menu is open.
 void PD1990::getDateTime(void) {
     struct timeval timeValue;
-    struct tm *now;
-
     gettimeofday(&timeValue, NULL);
-    now = localtime(&timeValue.tv_sec);
+    time_t time = timeValue.tv_sec + mTimeOffset;
+    struct tm *now = localtime(&time);
 
     mOutData = ((uint64_t)(now->tm_mon + 1) << 36) | ((uint64_t)now->tm_wday << 32) | (toBCD(now->tm_mday) << 24) |
                (toBCD(now->tm_hour) << 16) | (toBCD(now->tm_min) << 8) | toBCD(now->tm_sec);
 }
 
 void PD1990::setDateTime(void) {
-    struct timeval timeValue;
     struct tm now;
 
-    memset(&timeValue, 0, sizeof(timeValue));
     memset(&now, 0, sizeof(now));
 
     now.tm_year = 1982 - 1900;
@@ -139,8 +144,9 @@ void PD1990::setDateTime(void) {
     now.tm_min = toBin((mInData & 0xff00) >> 8);
     now.tm_sec = toBin(mInData & 0xff);
 
-    timeValue.tv_sec = mktime(&now);
-    settimeofday(&timeValue, NULL);
+    struct timeval timeValue;
+    gettimeofday(&timeValue, NULL);
+    mTimeOffset = mktime(&now) - timeValue.tv_sec;  // the ESP32 system time is left alone
 }
 
 uint8_t PD1990::toBCD(uint8_t value) { return (value / 10) * 16 + (value % 10); }
@@ -25,16 +25,24 @@
 #pragma GCC optimize("O2")
 
 #include <cstdint>
+#include <ctime>
+
+#include "pc80io.h"
 
 class PD1990 {
    public:
     PD1990();
     ~PD1990();
 
+
     uint8_t read(void);
     void write(int address, uint8_t value);
 
+    void registerIO(PC80IO *io);
+
    private:
+    time_t mTimeOffset;  // set time minus the ESP32 time
+
     uint8_t mCmd;
     bool mDataIn;
 
@@ -47,6 +55,7 @@ class PD1990 {
     uint64_t mOutData;
 
     void clockSTB(void);
+    static void ioOutCmd(void *arg, int port, int value);
 
     void getDateTime(void);
     uint8_t toBCD(uint8_t value);
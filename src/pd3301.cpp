@@ -38,8 +38,22 @@
 PD3301::PD3301() : mDisplayController(false) {}
 PD3301::~PD3301() {}
 
-int PD3301::init(uint8_t *vrtc) {
+int PD3301::init(uint8_t *vrtc, PC80SCHEDULER *scheduler) {
     mVRTC = vrtc;
+    mVSyncTask = nullptr;
+    mRenderer = renderBlank;
+    mVideoMode = VIDEO_60HZ;
+    mCpuBehind = false;
+    mRefreshInterval = 1;
+    mSkipCount = 0;
+
+    // VRTC follows emulated time, independent of the VGA output.
+    mScheduler = scheduler;
+    mVRTCEvent = mScheduler->add(vrtcEvent, this);
+    mFrameCycles = CPU_CLOCK / FRAME_RATE;
+
+    // The cache rebuild runs next to the CPU emulation on the other core.
+    mRebuildTask = PC80HAL::createTask(&rebuildTask, "pd3301Task", 2048, this, 2, HAL_CORE_IO);
 
     // DisplayController.
     fabgl::BitmappedDisplayController::queueSize = 128;
@@ -52,16 +66,39 @@ int PD3301::init(uint8_t *vrtc) {
     Serial.println("DisplayController init completed");
 #endif
 
-    mVramCol = (uint8_t *)heap_caps_malloc(20, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
-    mVramAttr = (uint8_t *)heap_caps_malloc(20, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    // Tables read by drawScanline, 51KB of internal RAM in all (allocTable).
+    for (int i = 0; i < 2; i++) {
 #ifdef VRAM_CACHE_CAP_32BIT
-    mVramCache = (uint32_t *)heap_caps_malloc(80 * 25 * sizeof(uint32_t), MALLOC_CAP_32BIT | MALLOC_CAP_INTERNAL);
+        mVramCache[i] = (uint32_t *)allocTable(80 * 25 * sizeof(uint32_t), true);
 #else
-    mVramCache = (uint32_t *)heap_caps_malloc(80 * 25 * sizeof(uint32_t), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+        mVramCache[i] = (uint32_t *)allocTable(80 * 25 * sizeof(uint32_t), false);
 #endif
-    for (int i = 0; i < 80 * 25; i++) {
-        *(mVramCache + i) = WHITE;
+        if (mVramCache[i] == nullptr) return -1;
+        for (int j = 0; j < 80 * 25; j++) {
+            *(mVramCache[i] + j) = WHITE;
+        }
     }
+    mFront = 0;
+    mLatched = 0;
+    memset(mStaleRow, false, sizeof(mStaleRow));
+    memset(mRowVersion, 0, sizeof(mRowVersion));
+    memset(mRowContent, 0, sizeof(mRowContent));
+    memset(mRunMode, 0xff, sizeof(mRunMode));
+
+    // Glyph row and text row of each display line for 25 line (8 lines/row) and 20 line (10 lines/row) modes
+    for (int i = 0; i < 200; i++) {
+        mGlyphRow[0][i] = i % 8;
+        mTextRow[0][i] = i / 8;
+        mGlyphRow[1][i] = i % 10;
+        mTextRow[1][i] = i / 10;
+    }
+
+    // Rendered glyph lines (after all attribute processing) and cell colours
+    mLineFont = (uint8_t *)allocTable(200 * 80, false);
+    mRowColor = (uint8_t *)allocTable(25 * 80, false);
+    if (mLineFont == nullptr || mRowColor == nullptr) return -1;
+    mFontGeneration = 0;
+    mRenderedFontGeneration = ~0;
 
     mColor[BLACK] = RGB_COLOR222(0, 0, 0);
     mColor[BLUE] = RGB_COLOR222(0, 0, 3);
@@ -72,7 +109,8 @@ int PD3301::init(uint8_t *vrtc) {
     mColor[YELLOW] = RGB_COLOR222(3, 3, 0);
     mColor[WHITE] = RGB_COLOR222(3, 3, 3);
 
-    mColor64 = (uint64_t *)heap_caps_malloc(8 * sizeof(uint64_t), MALLOC_CAP_32BIT | MALLOC_CAP_INTERNAL);
+    mColor64 = (uint64_t *)allocTable(8 * sizeof(uint64_t), true);
+    if (mColor64 == nullptr) return -1;
 
     for (int i = 0; i < 8; i++) {
         uint64_t color64;
@@ -80,7 +118,8 @@ int PD3301::init(uint8_t *vrtc) {
         *(mColor64 + i) = color64;
     }
 
-    mFont64 = (uint64_t *)heap_caps_malloc(256 * sizeof(uint64_t), MALLOC_CAP_32BIT | MALLOC_CAP_INTERNAL);
+    mFont64 = (uint64_t *)allocTable(256 * sizeof(uint64_t), true);
+    if (mFont64 == nullptr) return -1;
 
     for (int i = 0; i < 256; i++) {
         uint64_t font64 = 0;
@@ -104,6 +143,15 @@ int PD3301::init(uint8_t *vrtc) {
         mFont64[i] = font64;
     }
 
+    // Fused colour and glyph table, 8 colours * 256 glyph bytes (16KB)
+    mGlyph64 = (uint64_t *)allocTable(8 * 256 * sizeof(uint64_t), true);
+    if (mGlyph64 == nullptr) return -1;
+#ifdef DEBUG_PD3301_BENCHMARK
+    mBenchSeparate = 0;
+    mBenchFused = 0;
+    mBenchCount = 0;
+#endif
+
     reset();
 
 #ifdef DEBUG_PD3301
@@ -115,6 +163,19 @@ int PD3301::init(uint8_t *vrtc) {
     return 0;
 }
 
+// Internal RAM first; when FabGL's VGA buffers leave too little of it, PSRAM, which is slower
+// but still readable from the VGA callback. nullptr only when both are exhausted.
+void *PD3301::allocTable(size_t size, bool cap32) {
+    auto mem = cap32 ? PC80HAL::allocInternal32(size) : PC80HAL::allocInternal(size);
+    if (mem == nullptr) {
+#ifdef DEBUG_PD3301
+        Serial.printf("PD3301: %d bytes of tables in PSRAM\n", size);
+#endif
+        mem = PC80HAL::alloc(size);
+    }
+    return mem;
+}
+
 void PD3301::setMemory(uint8_t *ramPtr, uint8_t *fontPtr) {
     mRAM = ramPtr;
 
@@ -140,17 +201,43 @@ void PD3301::reset() {
     mCharRows = 16;
 
     mPCG = false;
-    mUpdateVRAM = false;
 
     mReverse = false;
+
+    selectRenderer();
+    invalidate();
+
+    // Start of the active display period
+    *mVRTC &= 0xdf;
+    mScheduler->schedule(mVRTCEvent, mFrameCycles * VRTC_ACTIVE_LINES / VRTC_TOTAL_LINES);
+}
+
+void PD3301::vrtcEvent(void *arg) {
+    auto pd3301 = (PD3301 *)arg;
+    int active = pd3301->mFrameCycles * VRTC_ACTIVE_LINES / VRTC_TOTAL_LINES;
+
+    if (*pd3301->mVRTC & 0x20) {
+        *pd3301->mVRTC &= 0xdf;
+        pd3301->mScheduler->schedule(pd3301->mVRTCEvent, active);
+    } else {
+        *pd3301->mVRTC |= 0x20;
+        pd3301->mScheduler->schedule(pd3301->mVRTCEvent, pd3301->mFrameCycles - active);
+    }
 }
 
 void PD3301::end() { mDisplayController.end(); }
 
+// Rebuild every row of the VRAM cache on the next update.
+void PD3301::invalidate(void) {
+    memset((void *)mDirtyRow, true, sizeof(mDirtyRow));
+    mFontGeneration++;
+}
+
 void PD3301::setVRAM(int vram) {
 #ifdef DEBUG_PD3301
     Serial.printf("VRAM %04x\n", vram);
 #endif
+    if (mVRAM != vram) invalidate();
     mVRAM = vram;
 }
 
@@ -162,6 +249,8 @@ void PD3301::setDMA(bool status) {
     Serial.printf("DMA start %s\n", status ? "true" : "false");
 #endif
     mDisplay = mDMAStart && mTextOn;
+    selectRenderer();
+    invalidate();
 }
 
 // dispdrivers/vgadirectcontroller.cpp L287
@@ -172,24 +261,41 @@ void PD3301::run(void) {
     mDisplayController.setScanlinesPerCallBack(SCANLINES_PER_CALLBACK);
     mDisplayController.setDrawScanlineCallback(drawScanline, this);
     mDisplayController.setResolution(VGA_640x480_60Hz);
+    buildGlyphTable();
     mDisplayController.run();
 }
 
+// The sync bits depend on the resolution, so the table is built after setResolution.
+void PD3301::buildGlyphTable(void) {
+    uint64_t hvsyncs64;
+    memset(&hvsyncs64, mDisplayController.createBlankRawPixel(), 8);
+
+    for (int color = 0; color < 8; color++) {
+        for (int font = 0; font < 256; font++) {
+            mGlyph64[(color << 8) | font] = (mColor64[color] & mFont64[font]) | hvsyncs64;
+        }
+    }
+}
+
 void PD3301::crtcCmd(uint8_t value) {
     mCRTCDataCount = 0;
 
     if ((value & 0xfe) == CRTC_OCW5) {  // OCw5: Load cursor position
         mCRTCCmd = CRTC_OCW5;
         mCursorDisplay = value & 0x01;
+        selectRenderer();
     } else if (value == CRTC_OCW1_ICW) {
         mCRTCCmd = CRTC_OCW1_ICW;  // ICW (OCW1): Stop display
         mTextOn = false;
         mDisplay = mDMAStart && mTextOn;
+        selectRenderer();
     } else if ((value & 0xfe) == CRTC_OCW2) {
         mCRTCCmd = CRTC_OCW2;  // OCW2: Start display
         mReverse = value & 0x01;
         mTextOn = true;
         mDisplay = mDMAStart && mTextOn;
+        selectRenderer();
+        invalidate();
 #ifdef DEBUG_PD3301
         Serial.println("OCW2: Start display");
 #endif
@@ -212,6 +318,8 @@ void PD3301::crtcData(uint8_t value) {
         mLine25 = (mCRTCData[1] & 0x3f) == 0x18;
         mCharRows = mLine25 ? 16 : 20;
         mColorMode = (mCRTCData[4] & 0x40);
+        selectRenderer();
+        invalidate();
         mCRTCCmd = 0;
         mCRTCDataCount = 0;
     } else if ((mCRTCCmd & 0xfe) == CRTC_OCW5 && (mCRTCDataCount == 2)) {
@@ -225,13 +333,27 @@ void PD3301::crtcData(uint8_t value) {
     }
 }
 
+void PD3301::registerIO(PC80IO *io) {
+    io->setIn(0x50, 0x50, ioIn50, this);
+    io->setIn(0x51, 0x51, ioIn51, this);
+    io->setOut(0x50, 0x50, ioOut50, this);
+    io->setOut(0x51, 0x51, ioOut51, this);
+}
+
+int PD3301::ioIn50(void *arg, int port) { return ((PD3301 *)arg)->inPort50(); }
+int PD3301::ioIn51(void *arg, int port) { return ((PD3301 *)arg)->inPort51(); }
+void PD3301::ioOut50(void *arg, int port, int value) { ((PD3301 *)arg)->crtcData(value); }
+void PD3301::ioOut51(void *arg, int port, int value) { ((PD3301 *)arg)->crtcCmd(value); }
+
 uint8_t PD3301::inPort50(void) { return 0; }  // CRTC Data port
 
 uint8_t PD3301::inPort51(void) { return mCRTCCmd; }  // CRTC Control port
 
 void PD3301::setCloumn80(bool value) {
+    if (mColumn80 != value) invalidate();
     mColumn80 = value;
     mCursorMask = value ? 0xff : 0xfe;
+    selectRenderer();
 }
 
 void PD3301::setPCG(bool value) {
@@ -239,6 +361,7 @@ void PD3301::setPCG(bool value) {
     Serial.printf("PD3301:PCG %s\n", value ? "on" : "off");
 #endif
     mPCG = value;
+    invalidate();
 }
 bool PD3301::getPCG() { return mPCG; }
 
@@ -264,342 +387,449 @@ uint8_t PD3301::RGB_COLOR222(uint8_t r, uint8_t g, uint8_t b) { return ((b & 0x3
 void IRAM_ATTR PD3301::drawScanline(void *arg, uint8_t *dest, int scanLine) {
     auto pd3301 = (PD3301 *)arg;
 
-    auto boarderColor = pd3301->mDisplayController.createRawPixel(RGB222(0, 0, 0));
-    uint64_t hvsyncs64;
-    memset(&hvsyncs64, pd3301->mDisplayController.createBlankRawPixel(), 8);
-    auto fontPtr = pd3301->mFontPtr;
-    auto vramCache = pd3301->mVramCache;
-    auto charRows = pd3301->mCharRows;
-    auto color64 = pd3301->mColor64;
-    auto font64 = pd3301->mFont64;
-
     if (scanLine == 0) {
         pd3301->mFrameCounter++;
-        *pd3301->mVRTC &= 0xdf;
+        pd3301->latchFrame();
     }
 
-    if (pd3301->mDisplay) {
-        auto cursorMask = pd3301->mCursorMask;
-        for (int line = scanLine; line < scanLine + SCANLINES_PER_CALLBACK; line += 2) {
-            if (line < SCREEN_BORDER || line >= 400 + SCREEN_BORDER) {
-                memset(dest, boarderColor, SCREEN_WIDTH);
-                memset(dest + SCREEN_WIDTH, boarderColor, SCREEN_WIDTH);
-            } else {
-                int y = line - SCREEN_BORDER;
+    pd3301->mRenderer(pd3301, dest, scanLine);
 
-                auto row = (y % charRows) >> 1;
-                auto upper = row == 0;
-                y /= charRows;
-                auto under = row == ((charRows >> 1) - 1);
+    if (scanLine >= 480 - SCANLINES_PER_CALLBACK) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(pd3301->mRebuildTask, &woken);
+        if (pd3301->mVSyncTask) {
+            vTaskNotifyGiveFromISR(pd3301->mVSyncTask, &woken);
+        }
+        if (woken) portYIELD_FROM_ISR();
+    }
+}
 
-                bool blink = (pd3301->mFrameCounter & 0x3f) < 0x0f;
-                bool cursorOn = (pd3301->mCursorDisplay && (pd3301->mCursorY == y)) && blink;
-                auto cursorX = pd3301->mCursorX;
+// Keeps one complete cache for the whole frame.
+void IRAM_ATTR PD3301::latchFrame(void) {
+    mLatched = mFront;
 
-                auto reverse = pd3301->mReverse;
+    if (mRenderedFontGeneration != mFontGeneration) {
+        mRenderedFontGeneration = mFontGeneration;
+        memset(mLineKey, 0xff, sizeof(mLineKey));
+        memset(mRowColorKey, 0xff, sizeof(mRowColorKey));
+    }
+}
 
-                y *= 80;
+// Renders the current screen into a 640x480 buffer of raw pixels without the VGA output.
+// Only for use while the display is suspended, as it drives the rebuild and the renderer itself.
+void PD3301::renderFrame(uint8_t *frame) {
+    invalidate();
+    mLatched = mFront;
+    updateVRAMcahce();
+    latchFrame();
 
-                for (int x = 0; x < SCREEN_WIDTH / 8; x++) {
-                    auto attr = vramCache[x + y];
-                    auto font = fontPtr[(attr >> 16) * 10 + row];
-                    if (attr & ATTR_SECRET) {
-                        font = 0;
-                    }
-                    if (attr & ATTR_REVERSE) {
-                        font = ~font;
-                    }
-                    if ((attr & ATTR_BLINK) && blink) {
-                        attr &= 0xf0;
-                    }
-                    if ((attr & ATTR_UPPERLINE) && upper) {
-                        font = 0xff;
-                    }
-                    if ((attr & ATTR_UNDERLINE) && under) {
-                        font = 0xff;
-                    }
-                    font ^= (cursorOn && (x & cursorMask) == cursorX) ? 0xff : 0;
-                    if (reverse) {
-                        font = ~font;
-                    }
+    for (int scanLine = 0; scanLine < 480; scanLine += SCANLINES_PER_CALLBACK) {
+        mRenderer(this, frame + scanLine * SCREEN_WIDTH, scanLine);
+    }
+}
 
-                    uint64_t pixels64 = (color64[attr & 0x07] & font64[font]) | hvsyncs64;
+// Saves the current screen as a binary PPM file.
+int PD3301::saveScreenshot(const char *fileName) {
+    auto frame = (uint8_t *)PC80HAL::alloc(SCREEN_WIDTH * 480);
+    auto line = (uint8_t *)PC80HAL::alloc(SCREEN_WIDTH * 3);
+    if (!frame || !line) {
+        free(frame);
+        free(line);
+        return -1;
+    }
 
-                    *((uint64_t *)dest + x) = pixels64;
-                    *((uint64_t *)dest + x + SCREEN_WIDTH / 8) = pixels64;
-                }
+    renderFrame(frame);
+
+    int rc = -1;
+    auto fp = fopen(fileName, "wb");
+    if (fp) {
+        fprintf(fp, "P6\n%d %d\n255\n", SCREEN_WIDTH, 480);
+        for (int y = 0; y < 480; y++) {
+            auto src = frame + y * SCREEN_WIDTH;
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                // Lines are in VGA DMA order: pixels 2, 3, 0, 1 of every group of four (VGA_PIXELINROW)
+                auto pixel = src[x ^ 2];
+                // Raw pixel: bits 0-1 red, 2-3 green, 4-5 blue
+                line[x * 3] = (pixel & 0x03) * 85;
+                line[x * 3 + 1] = ((pixel >> 2) & 0x03) * 85;
+                line[x * 3 + 2] = ((pixel >> 4) & 0x03) * 85;
             }
-            dest += SCREEN_WIDTH * 2;
-        }
-    } else {  // DMA off
-        auto blackColor = pd3301->mDisplayController.createRawPixel(RGB222(0, 0, 0));
-        for (int line = scanLine; line < scanLine + SCANLINES_PER_CALLBACK; line += 2) {
-            memset(dest, boarderColor, SCREEN_WIDTH);
-            memset(dest + SCREEN_WIDTH, boarderColor, SCREEN_WIDTH);
-            dest += SCREEN_WIDTH * 2;
+            if (fwrite(line, 1, SCREEN_WIDTH * 3, fp) != SCREEN_WIDTH * 3) break;
+            if (y == 479) rc = 0;
         }
+        fclose(fp);
     }
 
-    if (scanLine >= 480 - SCANLINES_PER_CALLBACK) {
-        *pd3301->mVRTC |= 0x20;
-        pd3301->mUpdateVRAM = true;
+    free(frame);
+    free(line);
+    return rc;
+}
+
+// Picks the scanline renderer for the current CRTC mode; called whenever the mode changes.
+void PD3301::selectRenderer(void) {
+    if (!mDisplay) {
+        mRenderer = renderBlank;
+    } else if (mCharRows == 16) {
+        mRenderer = mCursorDisplay ? renderText<16, true> : renderText<16, false>;
+    } else {
+        mRenderer = mCursorDisplay ? renderText<20, true> : renderText<20, false>;
     }
 }
 
-void IRAM_ATTR PD3301::updateVRAMcahce(void) {
-    if (!mDisplay) return;
-    if (!mUpdateVRAM) return;
+// DMA off
+void IRAM_ATTR PD3301::renderBlank(PD3301 *pd3301, uint8_t *dest, int scanLine) {
+    auto boarderColor = pd3301->mDisplayController.createRawPixel(RGB222(0, 0, 0));
+    memset(dest, boarderColor, SCREEN_WIDTH * SCANLINES_PER_CALLBACK);
+}
 
-    mUpdateVRAM = false;
+template <int charRows, bool cursor>
+void IRAM_ATTR PD3301::renderText(PD3301 *pd3301, uint8_t *dest, int scanLine) {
+    auto boarderColor = pd3301->mDisplayController.createRawPixel(RGB222(0, 0, 0));
 
-    uint16_t prevAttr = WHITE;
+    // Border lines above and below the 400 line text area
+    int line = scanLine;
+    int end = scanLine + SCANLINES_PER_CALLBACK;
+    int textEnd = end < 400 + SCREEN_BORDER ? end : 400 + SCREEN_BORDER;
+    if (line < SCREEN_BORDER) {
+        int lines = (end < SCREEN_BORDER ? end : SCREEN_BORDER) - line;
+        memset(dest, boarderColor, SCREEN_WIDTH * lines);
+        dest += SCREEN_WIDTH * lines;
+        line += lines;
+    }
 
-    if (mColumn80) {
-        auto pcg = mPCG ? 0x200 : 0;
-        for (int row = 0; row < 25; row++) {
-            auto attrMode = false;
-            auto attrPtr = mRAM + mVRAM + 120 * row + 80;
-            memset(mVramCol, 0x80, 20);
-            memset(mVramAttr, 0, 20);
-            int j = 0;
-            mVramCol[j] = *attrPtr;
-            if (*attrPtr >= 0x80) attrMode = true;
-            attrPtr++;
-            mVramAttr[j] = *attrPtr;
-            attrPtr++;
-            j++;
-            for (int i = 1; i < 20; i++) {
-                auto col = *attrPtr;
-                attrPtr++;
-                auto value = *attrPtr;
-                attrPtr++;
-                if (col >= 0x80) attrMode = true;
-                if (col > mVramCol[j - 1]) {
-                    mVramCol[j] = col;
-                    mVramAttr[j] = value;
-                    j++;
-                } else if (col < mVramCol[j - 1]) {
-                    for (int k = 0; k < j - 1; k++) {
-                        if (mVramCol[k] == col) {
-                            break;
-                        } else if (mVramCol[k] > col) {
-                            for (int l = 19; l >= k; l--) {
-                                mVramCol[l + 1] = mVramCol[l];
-                                mVramAttr[l + 1] = mVramAttr[l];
-                            }
-                            mVramCol[k] = col;
-                            mVramAttr[k] = value;
-                            j++;
-                            break;
-                        }
-                    }
+    auto latched = pd3301->mLatched;
+    auto fontPtr = pd3301->mFontPtr;
+    auto vramCache = pd3301->mVramCache[latched];
+    auto glyph64 = pd3301->mGlyph64;
+    auto glyphRows = pd3301->mGlyphRow[charRows == 20];
+    auto textRows = pd3301->mTextRow[charRows == 20];
+
+    bool blink = (pd3301->mFrameCounter & 0x3f) < 0x0f;
+    auto cursorMask = pd3301->mCursorMask;
+    auto cursorX = pd3301->mCursorX;
+    auto cursorY = pd3301->mCursorY;
+    auto reverse = pd3301->mReverse;
+
+    for (; line < textEnd; line += 2) {
+        auto index = (line - SCREEN_BORDER) >> 1;  // display line 0-199
+        int row = glyphRows[index];
+        int y = textRows[index];
+
+        bool cursorOn = cursor && blink && cursorY == y;
+        uint32_t version = (uint32_t)pd3301->mRowVersion[latched][y] << 16;  // same in both buffers after a copy
+
+        // Glyph line cache: re-rendered only when the row, cursor or reverse mode changed.
+        auto fontLine = pd3301->mLineFont + index * 80;
+        uint32_t key = version | (reverse << 14) | (cursorOn ? 0x1000 | cursorX : 0);
+        if (pd3301->mLineKey[index] != key) {
+            pd3301->mLineKey[index] = key;
+            auto upper = row == 0;
+            auto under = row == (charRows >> 1) - 1;
+            int block = row < 8 ? row >> 1 : 8;  // block row of graphic cells (2 glyph rows each), 8: below the blocks
+            auto cache = vramCache + y * 80;
+            for (int x = 0; x < SCREEN_WIDTH / 8; x++) {
+                auto attr = cache[x];
+                int code = attr >> 16;
+                uint8_t font;
+                if (attr & ATTR_CHAR_GRAPH) {  // 2x4 blocks straight from the cell byte
+                    font = (((code >> block) & 1) ? 0xf0 : 0) | (((code >> (block + 4)) & 1) ? 0x0f : 0);
+                } else {
+                    font = fontPtr[code * 10 + row];
+                }
+                if (attr & ATTR_SECRET) {
+                    font = 0;
+                }
+                if (attr & ATTR_REVERSE) {
+                    font = ~font;
+                }
+                if ((attr & ATTR_UPPERLINE) && upper) {
+                    font = 0xff;
+                }
+                if ((attr & ATTR_UNDERLINE) && under) {
+                    font = 0xff;
+                }
+                if (cursor) {
+                    font ^= (cursorOn && (x & cursorMask) == cursorX) ? 0xff : 0;
                 }
+                if (reverse) {
+                    font = ~font;
+                }
+                fontLine[x] = font;
             }
+        }
 
-            uint16_t attr;
-            uint8_t vramAttr;
-            int curCol, col, graphic;
-            auto cache = mVramCache + row * 80;
-            auto vram = mVRAM + row * 120;
-
-            col = 0;
-            curCol = 0;
-
-            if (mColorMode) {  // Color
-                bool mode = mVramCol[0] != 0;
-                for (int i = 0; i < 20; i++) {
-                    col = mVramCol[i];
-                    vramAttr = mVramAttr[i];
-                    attr = prevAttr & 0xffff;
-                    if (vramAttr & 0x08) {
-                        attr &= 0x7f00;
-                        if (vramAttr & 0x10) {  // Character/Graphic for color mode
-                            attr |= ATTR_CHAR_GRAPH;
-                        }
-                        attr |= vramAttr >> 5;  // color
-                    } else {
-                        attr &= 0x80ff;
-                        attr |= (vramAttr & 0x37) << 8;
-                    }
+        // Cell colours of the row, re-built when the row or the blink phase changed.
+        auto colorRow = pd3301->mRowColor + y * 80;
+        key = version | blink;
+        if (pd3301->mRowColorKey[y] != key) {
+            pd3301->mRowColorKey[y] = key;
+            auto cache = vramCache + y * 80;
+            for (int x = 0; x < SCREEN_WIDTH / 8; x++) {
+                auto attr = cache[x];
+                colorRow[x] = ((attr & ATTR_BLINK) && blink) ? 0 : attr & 0x07;
+            }
+        }
 
-                    if (attrMode) {  // N88
-                        prevAttr = attr;
-                    }
-                    if (col > 0x50) col = 0x50;
-                    for (int i = curCol; i < col; i++) {
-                        int offset = mRAM[vram + i];
-                        if (prevAttr & ATTR_CHAR_GRAPH) {
-                            offset += 0x100;
-                        } else {
-                            offset += pcg;
-                        }
-                        *(cache + i) = prevAttr | (offset << 16);
-                    }
+#ifdef DEBUG_PD3301_BENCHMARK
+        if (index == 100) pd3301->benchmarkLine(dest, fontLine, colorRow);
+#endif
+        for (int x = 0; x < SCREEN_WIDTH / 8; x++) {
+            uint64_t pixels64 = glyph64[(colorRow[x] << 8) | fontLine[x]];
 
-                    curCol = col;
-                    if (col >= 0x50) {
-                        break;
-                    }
-                    prevAttr = attr;
-                }
-            } else {  // Mono
-                for (int i = 0; i < 20; i++) {
-                    col = mVramCol[i];
-                    vramAttr = mVramAttr[i];
-                    if (vramAttr & 0x08) {
-                        attr = prevAttr;
-                    } else {
-                        attr = WHITE | (vramAttr << 8);
-                    }
+            *((uint64_t *)dest + x) = pixels64;
+            *((uint64_t *)dest + x + SCREEN_WIDTH / 8) = pixels64;
+        }
+        dest += SCREEN_WIDTH * 2;
+    }
 
-                    if (attrMode) {  // N88
-                        prevAttr = attr;
-                    }
-                    if (col > 0x50) col = 0x50;
-                    for (int i = curCol; i < col; i++) {
-                        int offset = mRAM[vram + i];
-                        if (prevAttr & ATTR_CHAR_GRAPH) {
-                            offset += 0x100;
-                        } else {
-                            offset += pcg;
-                        }
-                        *(cache + i) = prevAttr | (offset << 16);
-                    }
+    if (line < end) {
+        memset(dest, boarderColor, SCREEN_WIDTH * (end - line));
+    }
+}
 
-                    curCol = col;
-                    if (col >= 0x50) {
-                        break;
+// Rebuilds the VRAM cache once per frame, woken by the last scanline callback.
+void PD3301::rebuildTask(void *arg) {
+    auto pd3301 = (PD3301 *)arg;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (pd3301->skipFrame()) continue;
+        pd3301->updateVRAMcahce();
+#ifdef DEBUG_PD3301_BENCHMARK
+        if (pd3301->mBenchCount >= 60) {
+            Serial.printf("PD3301 line: %d cycles (separate tables), %d cycles (fused table)\n", pd3301->mBenchSeparate / pd3301->mBenchCount,
+                          pd3301->mBenchFused / pd3301->mBenchCount);
+            pd3301->mBenchSeparate = 0;
+            pd3301->mBenchFused = 0;
+            pd3301->mBenchCount = 0;
+        }
+#endif
+    }
+}
+
+// Returns true when this frame's cache refresh is skipped by the video mode.
+bool PD3301::skipFrame(void) {
+    int interval;
+    if (mVideoMode == VIDEO_AUTO) {
+        if (mCpuBehind) {
+            if (mRefreshInterval < VIDEO_AUTO_MAX_INTERVAL) mRefreshInterval++;
+        } else if (mRefreshInterval > 1) {
+            mRefreshInterval--;
+        }
+        interval = mRefreshInterval;
+    } else {
+        interval = mVideoMode + 1;
+    }
+
+    if (++mSkipCount < interval) return true;
+    mSkipCount = 0;
+    return false;
+}
+
+#ifdef DEBUG_PD3301_BENCHMARK
+// Times one 640 pixel line with the former expression and with the fused table.
+void IRAM_ATTR PD3301::benchmarkLine(uint8_t *dest, uint8_t *fontLine, uint8_t *colorRow) {
+    uint64_t hvsyncs64;
+    memset(&hvsyncs64, mDisplayController.createBlankRawPixel(), 8);
+    auto color64 = mColor64;
+    auto font64 = mFont64;
+    auto glyph64 = mGlyph64;
+
+    auto start = xthal_get_ccount();
+    for (int x = 0; x < SCREEN_WIDTH / 8; x++) {
+        *((uint64_t *)dest + x) = (color64[colorRow[x]] & font64[fontLine[x]]) | hvsyncs64;
+    }
+    auto middle = xthal_get_ccount();
+    for (int x = 0; x < SCREEN_WIDTH / 8; x++) {
+        *((uint64_t *)dest + x) = glyph64[(colorRow[x] << 8) | fontLine[x]];
+    }
+    auto end = xthal_get_ccount();
+
+    mBenchSeparate += middle - start;
+    mBenchFused += end - middle;
+    mBenchCount++;
+}
+#endif
+
+// Sorts a row's 20 (column, attribute) pairs and decodes them into runs of cells sharing one attribute word.
+// prevAttr is the attribute carried in from the previous row and returns the one carried out.
+template <bool column80, bool color>
+int PD3301::decodeAttributes(const uint8_t *attrPtr, uint16_t &prevAttr, attr_run_t *runs) {
+    uint8_t cols[20];
+    uint8_t values[20];
+    auto attrMode = false;
+
+    memset(cols, 0x80, 20);
+    memset(values, 0, 20);
+    int j = 0;
+    for (int i = 0; i < 20; i++) {
+        auto col = attrPtr[i * 2];
+        auto value = attrPtr[i * 2 + 1];
+        if (col >= 0x80) attrMode = true;
+        if (j == 0 || col > cols[j - 1]) {
+            cols[j] = col;
+            values[j] = value;
+            j++;
+        } else if (col < cols[j - 1]) {
+            for (int k = 0; k < j - 1; k++) {
+                if (cols[k] == col) {
+                    break;
+                } else if (cols[k] > col) {
+                    for (int l = j - 1; l >= k; l--) {
+                        cols[l + 1] = cols[l];
+                        values[l + 1] = values[l];
                     }
-                    prevAttr = attr;
+                    cols[k] = col;
+                    values[k] = value;
+                    j++;
+                    break;
                 }
             }
         }
-    } else {  // 40 columns
-        auto pcg = mPCG ? 0x400 : 0;
-        for (int row = 0; row < 25; row++) {
-            auto attrMode = false;
-            auto attrPtr = mRAM + mVRAM + 120 * row + 80;
-            memset(mVramCol, 0x80, 20);
-            memset(mVramAttr, 0, 20);
-            int j = 0;
-            mVramCol[j] = *attrPtr < 0x50 ? *attrPtr : 0x50;
-            mVramCol[j] = *attrPtr;
-            if (*attrPtr >= 0x80) attrMode = true;
-            attrPtr++;
-            mVramAttr[j] = *attrPtr;
-            attrPtr++;
-            j++;
-            for (int i = 1; i < 20; i++) {
-                auto col = *attrPtr;
-                attrPtr++;
-                auto value = *attrPtr;
-                attrPtr++;
-                if (col >= 0x80) attrMode = true;
-                if (col > mVramCol[j - 1]) {
-                    mVramCol[j] = col;
-                    mVramAttr[j] = value;
-                    j++;
-                } else if (col < mVramCol[j - 1]) {
-                    for (int k = 0; k < j - 1; k++) {
-                        if (mVramCol[k] == col) {
-                            break;
-                        } else if (mVramCol[k] > col) {
-                            for (int l = 19; l >= k; l--) {
-                                mVramCol[l + 1] = mVramCol[l];
-                                mVramAttr[l + 1] = mVramAttr[l];
-                            }
-                            mVramCol[k] = col;
-                            mVramAttr[k] = value;
-                            j++;
-                            break;
-                        }
-                    }
+    }
+
+    int count = 0;
+    int curCol = 0;
+    for (int i = 0; i < 20; i++) {
+        int col = cols[i];
+        uint8_t vramAttr = values[i];
+        uint16_t attr;
+        if (color) {
+            attr = prevAttr;
+            if (vramAttr & 0x08) {
+                attr &= 0x7f00;
+                if (vramAttr & 0x10) {  // Character/Graphic for color mode
+                    attr |= ATTR_CHAR_GRAPH;
                 }
+                attr |= vramAttr >> 5;  // color
+            } else {
+                attr &= 0x80ff;
+                attr |= (vramAttr & 0x37) << 8;
             }
+        } else {
+            if (vramAttr & 0x08) {
+                attr = prevAttr;
+            } else {
+                attr = WHITE | (vramAttr << 8);
+            }
+        }
 
-            uint16_t attr;
-            uint8_t vramAttr;
-            int curCol, col, graphic;
-            auto cache = mVramCache + row * 80;
-            auto vram = mVRAM + row * 120;
-
-            col = 0;
-            curCol = 0;
-
-            if (mColorMode) {  // Color
-                bool mode = mVramCol[0] != 0;
-                for (int i = 0; i < 20; i++) {
-                    col = mVramCol[i];
-                    vramAttr = mVramAttr[i];
-                    attr = prevAttr & 0xffff;
-                    if (vramAttr & 0x08) {
-                        attr &= 0x7f00;
-                        if (vramAttr & 0x10) {  // Character/Graphic for color mode
-                            attr |= ATTR_CHAR_GRAPH;
-                        }
-                        attr |= vramAttr >> 5;  // color
-                    } else {
-                        attr &= 0x80ff;
-                        attr |= (vramAttr & 0x37) << 8;
-                    }
+        if (!column80 && (col & 0x01)) col++;
 
-                    if (col & 0x01) col++;
+        if (attrMode) {  // N88
+            prevAttr = attr;
+        }
+        if (col > 0x50) col = 0x50;
+        if (col > curCol) {
+            runs[count].start = curCol;
+            runs[count].end = col;
+            runs[count].attr = prevAttr;
+            count++;
+        }
 
-                    if (attrMode) {  // N88
-                        prevAttr = attr;
-                    }
-                    if (col > 0x50) col = 0x50;
-                    for (int i = curCol; i < col; i += 2) {
-                        int offset = (mRAM[vram + i] << 1) + 0x300;
-                        if (prevAttr & ATTR_CHAR_GRAPH) {
-                            offset += 0x200;
-                        } else {
-                            offset += pcg;
-                        }
-                        *(cache + i) = prevAttr | (offset << 16);
-                        *(cache + i + 1) = prevAttr | ((offset + 1) << 16);
-                    }
+        curCol = col;
+        if (col >= 0x50) {
+            break;
+        }
+        prevAttr = attr;
+    }
+    if (curCol < 0x50) {  // all 20 pairs used before the end of the row
+        runs[count].start = curCol;
+        runs[count].end = 0x50;
+        runs[count].attr = prevAttr;
+        count++;
+    }
+    return count;
+}
 
-                    curCol = col;
-                    if (col >= 0x50) {
-                        break;
-                    }
-                    prevAttr = attr;
-                }
-            } else {  // Mono
-                for (int i = 0; i < 20; i++) {
-                    col = mVramCol[i];
-                    vramAttr = mVramAttr[i];
-                    if (vramAttr & 0x08) {
-                        attr = prevAttr;
-                    } else {
-                        attr = WHITE | (vramAttr << 8);
-                    }
+// Fills a row of the VRAM cache from its text and decoded attribute runs.
+template <bool column80>
+void PD3301::fillRow(uint32_t *cache, const uint8_t *text, const attr_run_t *runs, int count, int pcg) {
+    for (int r = 0; r < count; r++) {
+        uint32_t attr = runs[r].attr;
+        int end = runs[r].end;
+        if (column80) {
+            int base = (attr & ATTR_CHAR_GRAPH) ? 0 : pcg;
+            for (int i = runs[r].start; i < end; i++) {
+                cache[i] = attr | ((text[i] + base) << 16);
+            }
+        } else if (attr & ATTR_CHAR_GRAPH) {
+            // Each half of a doubled graphic cell repeats one column of blocks in both nibbles.
+            for (int i = runs[r].start; i < end; i += 2) {
+                int code = text[i];
+                cache[i] = attr | (((code & 0x0f) * 0x11) << 16);
+                cache[i + 1] = attr | (((code >> 4) * 0x11) << 16);
+            }
+        } else {
+            int base = 0x200 + pcg;
+            for (int i = runs[r].start; i < end; i += 2) {
+                int offset = (text[i] << 1) + base;
+                cache[i] = attr | (offset << 16);
+                cache[i + 1] = attr | ((offset + 1) << 16);
+            }
+        }
+    }
+}
 
-                    if (col & 0x01) col++;
+// Builds the back buffer and swaps it to the front; the renderer picks it up at the next frame.
+void IRAM_ATTR PD3301::updateVRAMcahce(void) {
+    if (!mDisplay) return;
 
-                    if (attrMode) {  // N88
-                        prevAttr = attr;
-                    }
-                    if (col > 0x50) col = 0x50;
-                    for (int i = curCol; i < col; i += 2) {
-                        int offset = (mRAM[vram + i] << 1) + 0x300;
-                        if (prevAttr & ATTR_CHAR_GRAPH) {
-                            offset += 0x200;
-                        } else {
-                            offset += pcg;
-                        }
-                        *(cache + i) = prevAttr | (offset << 16);
-                        *(cache + i + 1) = prevAttr | ((offset + 1) << 16);
-                    }
+    int back = mFront ^ 1;
+    if (back == mLatched) return;  // still being displayed; try again next frame
+    auto front = mVramCache[mFront];
 
-                    curCol = col;
-                    if (col >= 0x50) {
-                        break;
-                    }
-                    prevAttr = attr;
-                }
+    int mode = (mColumn80 ? 1 : 0) | (mColorMode ? 2 : 0);
+    int pcg = mPCG ? (mColumn80 ? 0x100 : 0x200) : 0;
+    uint16_t prevAttr = WHITE;
+
+    for (int row = 0; row < 25; row++) {
+        // Rows are rebuilt only when written or when the attribute carried in from the previous row changed.
+        if (!mDirtyRow[row] && mRowStartAttr[row] == prevAttr) {
+            if (mStaleRow[back][row]) {  // rebuilt last frame into the other buffer
+                memcpy(mVramCache[back] + row * 80, front + row * 80, 80 * sizeof(uint32_t));
+                mStaleRow[back][row] = false;
+                mRowVersion[back][row] = mRowVersion[mFront][row];
             }
+            prevAttr = mRowEndAttr[row];
+            continue;
+        }
+        mDirtyRow[row] = false;
+        mStaleRow[back][row] = false;
+        mStaleRow[mFront][row] = true;
+        mRowVersion[back][row] = ++mRowContent[row];
+
+        // Text-only writes reuse the decoded runs; the attribute area is decoded from a snapshot.
+        auto text = mRAM + mVRAM + 120 * row;
+        if (mRunMode[row] != mode || mRowStartAttr[row] != prevAttr || memcmp(mRunKey[row], text + 80, 40) != 0) {
+            mRunMode[row] = mode;
+            mRowStartAttr[row] = prevAttr;
+            memcpy(mRunKey[row], text + 80, 40);
+            switch (mode) {
+                case 0:
+                    mRunCount[row] = decodeAttributes<false, false>(mRunKey[row], prevAttr, mRuns[row]);
+                    break;
+                case 1:
+                    mRunCount[row] = decodeAttributes<true, false>(mRunKey[row], prevAttr, mRuns[row]);
+                    break;
+                case 2:
+                    mRunCount[row] = decodeAttributes<false, true>(mRunKey[row], prevAttr, mRuns[row]);
+                    break;
+                default:
+                    mRunCount[row] = decodeAttributes<true, true>(mRunKey[row], prevAttr, mRuns[row]);
+                    break;
+            }
+            mRowEndAttr[row] = prevAttr;
+        } else {
+            prevAttr = mRowEndAttr[row];
+        }
+
+        auto cache = mVramCache[back] + row * 80;
+        if (mColumn80) {
+            fillRow<true>(cache, text, mRuns[row], mRunCount[row], pcg);
+        } else {
+            fillRow<false>(cache, text, mRuns[row], mRunCount[row], pcg);
         }
     }
+
+    mFront = back;
 }
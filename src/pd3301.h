@@ -24,7 +24,13 @@
 
 #pragma GCC optimize("O2")
 
+#ifdef DEBUG_PC80
+// #define DEBUG_PD3301_BENCHMARK  // CPU cycles per rendered line, separate vs fused tables
+#endif
+
 class PC80VM;
+class PC80SCHEDULER;
+class PC80IO;
 
 #define BLACK 0
 #define BLUE 1
@@ -49,6 +55,26 @@ class PC80VM;
 #define GBANK_MAIN 3
 #define GBANK_UNUSED 4
 
+// VRAM cache refresh policy; the display itself and the guest VRTC always run at 60Hz
+#define VIDEO_60HZ (0)
+#define VIDEO_30HZ (1)
+#define VIDEO_20HZ (2)
+#define VIDEO_15HZ (3)
+#define VIDEO_AUTO (4)                // skip refreshes while the CPU misses its frame budget
+#define VIDEO_AUTO_MAX_INTERVAL (4)  // 15Hz
+
+#define VRTC_ACTIVE_LINES (200)
+#define VRTC_TOTAL_LINES (262)
+
+#define ATTR_RUNS_MAX (21)  // 20 attribute pairs plus the tail of the row
+
+// Cells [start, end) of a text row sharing one decoded attribute word
+typedef struct {
+    uint8_t start;
+    uint8_t end;
+    uint16_t attr;
+} attr_run_t;
+
 union union_8_32_t {
     uint32_t uint32;
     struct {
@@ -64,7 +90,7 @@ class PD3301 {
     PD3301();
     ~PD3301();
 
-    int init(uint8_t *vrtc);
+    int init(uint8_t *vrtc, PC80SCHEDULER *scheduler);
     void setMemory(uint8_t *ramPtr, uint8_t *fontPtr);
 
     void reset(void);
@@ -78,6 +104,8 @@ class PD3301 {
     void crtcData(uint8_t value);
     uint8_t inPort50(void);
     uint8_t inPort51(void);
+
+    void registerIO(PC80IO *io);
     int getVRAM(void);
 
     void setCloumn80(bool value);
@@ -86,9 +114,25 @@ class PD3301 {
     void suspend(bool value);
 
     void updateVRAMcahce(void);
+    void invalidate(void);
+    void fontChanged(void) { mFontGeneration++; }
+
+    // Mark the text row containing a written VRAM address for rebuild.
+    inline void touchVRAM(int address) {
+        unsigned int offset = address - mVRAM;
+        if (offset < 120 * 25) mDirtyRow[offset / 120] = true;
+    }
+    void setVSyncTask(TaskHandle_t task) { mVSyncTask = task; }
+    void setFrameCycles(int cycles) { mFrameCycles = cycles; }
+    void setVideoMode(int mode) { mVideoMode = mode; }
+    void setCpuBehind(bool value) { mCpuBehind = value; }
+    uint32_t getFrameCounter(void) { return mFrameCounter; }
 
     fabgl::VGADirectController *getDisplayController(void) { return &mDisplayController; }
 
+    void renderFrame(uint8_t *frame);
+    int saveScreenshot(const char *fileName);
+
    private:
     uint8_t mCRTCCmd;
     uint8_t mCRTCData[5];
@@ -119,6 +163,7 @@ class PD3301 {
     uint64_t *mColor64;
 
     uint64_t *mFont64;
+    uint64_t *mGlyph64;  // [colour][glyph byte], sync bits included
 
     bool mColorMode;
     bool mColumn80;
@@ -126,19 +171,83 @@ class PD3301 {
     bool mLine25;
     int mCharRows;
 
-    uint8_t *mVramCol;     // 20
-    uint8_t *mVramAttr;    // 20;
-    uint32_t *mVramCache;  // 80*25;
+    uint32_t *mVramCache[2];  // 80*25, double buffered
+    volatile int mFront;      // last completed buffer
+    volatile int mLatched;    // buffer the renderer reads in the current frame
+    bool mStaleRow[2][25];    // row was rebuilt into the other buffer
+    uint16_t mRowVersion[2][25];  // content held by each buffer; equal versions mean equal rows
+    uint16_t mRowContent[25];     // bumped whenever a row is rebuilt
+
+    // Rendered row cache (drawScanline)
+    uint8_t *mLineFont;  // 200 lines * 80 glyph bytes
+    uint8_t *mRowColor;  // 25 rows * 80 colours
+    uint32_t mLineKey[200];
+    uint32_t mRowColorKey[25];
+    volatile uint32_t mFontGeneration;
+    uint32_t mRenderedFontGeneration;
+
+    volatile bool mDirtyRow[25];
+    uint16_t mRowStartAttr[25];  // attribute carried into the row at its last rebuild
+    uint16_t mRowEndAttr[25];    // attribute carried out of the row
+
+    // Decoded attribute runs, reused while a row's attribute area and carried attribute are unchanged
+    uint8_t mRunKey[25][40];  // attribute area at the last decode
+    uint8_t mRunMode[25];     // bit 0: 80 columns, bit 1: color, 0xff: not decoded
+    uint8_t mRunCount[25];
+    attr_run_t mRuns[25][ATTR_RUNS_MAX];
 
     uint8_t *mVRTC;
 
+    PC80SCHEDULER *mScheduler;
+    int mVRTCEvent;
+    int mFrameCycles;  // CPU cycles per guest frame
+
     bool mPCG;
-    bool mUpdateVRAM;
 
     bool mReverse;
 
+    TaskHandle_t mVSyncTask;    // notified at the end of every frame
+    TaskHandle_t mRebuildTask;  // rebuilds the VRAM cache after every frame
+
+    volatile int mVideoMode;
+    volatile bool mCpuBehind;  // the CPU did not finish its last frame before VSync
+    int mRefreshInterval;      // frames per cache refresh (VIDEO_AUTO)
+    int mSkipCount;
+    bool skipFrame(void);
+
     fabgl::VGADirectController mDisplayController;
 
     static void drawScanline(void *arg, uint8_t *dest, int scanLine);
+    void latchFrame(void);
+
+    // Scanline renderer for the current CRTC mode, chosen by selectRenderer
+    void (*mRenderer)(PD3301 *pd3301, uint8_t *dest, int scanLine);
+    uint8_t mGlyphRow[2][200];  // [20 line mode][display line]: glyph row in the character
+    uint8_t mTextRow[2][200];   // [20 line mode][display line]: text row
+    void selectRenderer(void);
+    static void renderBlank(PD3301 *pd3301, uint8_t *dest, int scanLine);
+    template <int charRows, bool cursor>
+    static void renderText(PD3301 *pd3301, uint8_t *dest, int scanLine);
+    static void vrtcEvent(void *arg);
+    static void rebuildTask(void *arg);
+    void buildGlyphTable(void);
+    static void *allocTable(size_t size, bool cap32);
+
+    template <bool column80, bool color>
+    static int decodeAttributes(const uint8_t *attrPtr, uint16_t &prevAttr, attr_run_t *runs);
+    template <bool column80>
+    static void fillRow(uint32_t *cache, const uint8_t *text, const attr_run_t *runs, int count, int pcg);
+
+#ifdef DEBUG_PD3301_BENCHMARK
+    uint32_t mBenchSeparate;
+    uint32_t mBenchFused;
+    uint32_t mBenchCount;
+    void benchmarkLine(uint8_t *dest, uint8_t *fontLine, uint8_t *colorRow);
+#endif
+
+    static int ioIn50(void *arg, int port);
+    static int ioIn51(void *arg, int port);
+    static void ioOut50(void *arg, int port, int value);
+    static void ioOut51(void *arg, int port, int value);
     uint8_t RGB_COLOR222(uint8_t r, uint8_t g, uint8_t b);
 };
\ No newline at end of file
@@ -35,17 +35,32 @@ PD765C::PD765C() {
     mCmdCount = 0;
     mResultCount = 0;
 
-    mBuffer = (uint8_t *)ps_malloc(256 * 32);
+    mBuffer = (uint8_t *)PC80HAL::alloc(256 * 32);
 
-    for (int i; i < MAX_DRIVE; i++) {
+    mDiskCache = false;
+    mDiskOverlay = false;
+    mFlushNow = false;
+    // Both run on the VM core: HAL_CORE_IO is kept busy by the PC-80S31 loop they are meant to help.
+    // Read-ahead runs below the VM, in the time it sleeps waiting for VSync (never in no wait mode).
+    mWriterTask = PC80HAL::createTask(&writerTask, "pd765cTask", 4096, this, 1, HAL_CORE_VM);
+    mReadAheadQueue = xQueueCreate(8, sizeof(uint16_t));
+    PC80HAL::createTask(&readAheadTask, "pd765cReadAhead", 4096, this, 0, HAL_CORE_VM);
+
+    for (int i = 0; i < MAX_DRIVE; i++) {
         mDrive[i].motor = false;
         mDrive[i].hasResult = false;
         mDrive[i].result = 0;
         mDrive[i].cylinder = 0;
+        mDrive[i].direction = 1;
         mDrive[i].disk = new PC80D88;
+        mDrive[i].disk->setWriter(mWriterTask);
     }
 
     mIRQFlag = nullptr;
+    mScheduler = nullptr;
+#ifdef PC80_BENCHMARK
+    mTransferred = 0;
+#endif
 }
 PD765C::~PD765C() {}
 
@@ -62,10 +77,16 @@ void PD765C::writeF8(uint8_t value) {
 #ifdef DEBUG_PD765C
         Serial.printf("PD765C motor on/off: %02x\n", value & 0x0f);
 #endif
+        bool motorOff = false;
         for (int i = 0; i < MAX_DRIVE; i++) {
+            if (mDrive[i].motor && !(value & 0x01)) motorOff = true;
             mDrive[i].motor = value & 0x01;
             value = value >> 1;
         }
+        if (motorOff) {
+            mFlushNow = true;
+            xTaskNotifyGive(mWriterTask);
+        }
     } else {
         mWritePrecompensation = value;
 #ifdef DEBUG_PD765C
@@ -96,6 +117,9 @@ void PD765C::writeDataRegister(uint8_t value) {  // Port FB
             break;
         case EXECUTION_PHASE:
             executionPhaseWrite(value);
+#ifdef PC80_BENCHMARK
+            mTransferred++;
+#endif
             break;
         default:
 #ifdef DEBUG_PD765C
@@ -120,6 +144,9 @@ uint8_t PD765C::readDataRegister(void) {  // Port FB
             break;
         case EXECUTION_PHASE:
             result = executionPhaseRead();
+#ifdef PC80_BENCHMARK
+            mTransferred++;
+#endif
             break;
 
         default:
@@ -236,15 +263,49 @@ uint8_t PD765C::terminalCount(void) {
 }
 
 void PD765C::rasieIRQ(void) {
-    if (mIRQFlag) {
-        *mIRQFlag = true;
+    if (mScheduler) {
+        if (!mScheduler->isScheduled(mIRQEvent)) {
+            mScheduler->schedule(mIRQEvent, PD765C_IRQ_DELAY);
+        }
+    } else {
+        irqEvent(this);
+    }
+}
+
+void PD765C::irqEvent(void *arg) {
+    auto pd765c = (PD765C *)arg;
+    if (pd765c->mIRQFlag) {
+        *pd765c->mIRQFlag = true;
 #ifdef DEBUG_PD765C
         // Serial.println("mIRQFlag = true");
 #endif
     }
 }
 
-void PD765C::setIRQFlag(bool *irqFlag) { mIRQFlag = irqFlag; }
+void PD765C::setIRQFlag(bool *irqFlag, PC80SCHEDULER *scheduler) {
+    mIRQFlag = irqFlag;
+    mScheduler = scheduler;
+    if (mScheduler) mIRQEvent = mScheduler->add(irqEvent, this);
+}
+
+// Port F4h-FBh of the PC-80S31
+void PD765C::registerIO(PC80IO *io) {
+    io->setIn(0xf8, 0xf8, ioInF8, this);
+    io->setIn(0xfa, 0xfa, ioInFA, this);
+    io->setIn(0xfb, 0xfb, ioInFB, this);
+    io->setOut(0xf4, 0xf4, ioOutF4, this);
+    io->setOut(0xf7, 0xf7, ioOutF7, this);  // Window value for VFO
+    io->setOut(0xf8, 0xf8, ioOutF8, this);
+    io->setOut(0xfb, 0xfb, ioOutFB, this);
+}
+
+int PD765C::ioInF8(void *arg, int port) { return ((PD765C *)arg)->terminalCount(); }
+int PD765C::ioInFA(void *arg, int port) { return ((PD765C *)arg)->readStatusRegister(); }
+int PD765C::ioInFB(void *arg, int port) { return ((PD765C *)arg)->readDataRegister(); }
+void PD765C::ioOutF4(void *arg, int port, int value) { ((PD765C *)arg)->writeF4(value); }
+void PD765C::ioOutF7(void *arg, int port, int value) { ((PD765C *)arg)->writeF7(value); }
+void PD765C::ioOutF8(void *arg, int port, int value) { ((PD765C *)arg)->writeF8(value); }
+void PD765C::ioOutFB(void *arg, int port, int value) { ((PD765C *)arg)->writeDataRegister(value); }
 
 void PD765C::readData(void) {
     if (mCmdCount > 8) {
@@ -285,6 +346,13 @@ void PD765C::readData(void) {
 uint8_t PD765C::readDataExecution(void) {
     if (mBuffCount == 0 || mBuffOffset >= mBuffCount) {
         mIO.cylinder = mDrive[mIO.US].cylinder;
+        if (mBuffCount == 0) {  // first sector of the command
+            auto drive = &mDrive[mIO.US];
+            auto trackNo = mIO.cylinder * 2 + mIO.HD;
+            for (int i = 1; i <= PD765C_READ_AHEAD; i++) {
+                readAhead(mIO.US, trackNo + drive->direction * i);
+            }
+        }
         auto rc = mDrive[mIO.US].disk->readData(mBuffer, &mIO);
         if (rc > 0) {
             mBuffCount = rc;
@@ -632,7 +700,14 @@ void PD765C::seek(void) {
         Serial.printf("PD765C Seek (%02x %02x %02x) US: %d NCN: %02x\n", mCmd[0], mCmd[1], mCmd[2], mCmd[1] & 0x3, mCmd[2]);
 #endif
         mUS = mCmd[1] & 0x3;
-        mDrive[mUS].cylinder = mCmd[2];
+        auto drive = &mDrive[mUS];
+        if (mCmd[2] != drive->cylinder) {
+            drive->direction = mCmd[2] > drive->cylinder ? 1 : -1;
+        }
+        drive->cylinder = mCmd[2];
+        // Both sides of the next cylinder in the seek direction
+        readAhead(mUS, (drive->cylinder + drive->direction) * 2);
+        readAhead(mUS, (drive->cylinder + drive->direction) * 2 + 1);
         mResult[0] = ST0_SE | mUS;
         if (!mDrive[mUS].disk->isReady()) {
             mResult[0] |= ST0_AT;
@@ -696,12 +771,65 @@ void PD765C::senseDeviceStatus(void) {
     }
 }
 
-int PD765C::openDrive(int drive, char *fileName) { return mDrive[drive].disk->open(fileName); }
+int PD765C::openDrive(int drive, char *fileName) { return mDrive[drive].disk->open(fileName, mDiskCache, mDiskOverlay); }
 
 int PD765C::closeDrive(int drive) { return mDrive[drive].disk->close(); }
 
+int PD765C::commitOverlay(int drive) { return mDrive[drive].disk->commit(); }
+
+int PD765C::discardOverlay(int drive) { return mDrive[drive].disk->discard(); }
+
 void PD765C::eject(void) {
     for (int i = 0; i < MAX_DRIVE; i++) {
         mDrive[i].disk->close();
     }
 }
+
+// Writes pending writes of every drive back now.
+void PD765C::flush(void) {
+    for (int i = 0; i < MAX_DRIVE; i++) {
+        mDrive[i].disk->flush();
+    }
+}
+
+uint32_t PD765C::getReadAheadHits(void) {
+    uint32_t hits = 0;
+    for (int i = 0; i < MAX_DRIVE; i++) hits += mDrive[i].disk->getReadAheadHits();
+    return hits;
+}
+
+uint32_t PD765C::getReadAheadMisses(void) {
+    uint32_t misses = 0;
+    for (int i = 0; i < MAX_DRIVE; i++) misses += mDrive[i].disk->getReadAheadMisses();
+    return misses;
+}
+
+// Queues a track for loading in the background; requests are dropped when the queue is full.
+void PD765C::readAhead(int drive, int trackNo) {
+    if (trackNo < 0 || mDiskCache || !mDrive[drive].disk->isReady()) return;
+    uint16_t request = (drive << 8) | (trackNo & 0xff);
+    xQueueSend(mReadAheadQueue, &request, 0);
+}
+
+void PD765C::readAheadTask(void *arg) {
+    auto pd765c = (PD765C *)arg;
+    uint16_t request;
+    while (true) {
+        if (xQueueReceive(pd765c->mReadAheadQueue, &request, portMAX_DELAY) == pdTRUE) {
+            pd765c->mDrive[(request >> 8) & (MAX_DRIVE - 1)].disk->prefetch(request & 0xff);
+        }
+    }
+}
+
+// Writes dirty tracks back once writes have stopped for PD765C_WRITE_DELAY, or when a motor stops.
+void PD765C::writerTask(void *arg) {
+    auto pd765c = (PD765C *)arg;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for (int waited = 0; !pd765c->mFlushNow && waited < PD765C_WRITE_MAX_DELAY; waited += PD765C_WRITE_DELAY) {
+            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PD765C_WRITE_DELAY)) == 0) break;
+        }
+        pd765c->mFlushNow = false;
+        pd765c->flush();
+    }
+}
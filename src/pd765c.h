@@ -27,6 +27,9 @@
 #include <cstdint>
 
 #include "d88.h"
+#include "pc80hal.h"
+#include "pc80io.h"
+#include "pc80scheduler.h"
 
 #define WAITING_PHASE (0)
 #define COMMAND_PHASE (1)
@@ -100,11 +103,17 @@
 
 #define MAX_DRIVE (4)
 
+#define PD765C_IRQ_DELAY (64)  // CPU cycles from command completion to INT
+#define PD765C_WRITE_DELAY (100)       // ms without writes before dirty tracks are written back
+#define PD765C_WRITE_MAX_DELAY (1000)  // ms at most between a write and its write-back
+#define PD765C_READ_AHEAD (2)      // tracks loaded ahead in the direction of the last seek
+
 typedef struct {
     bool motor;
     bool hasResult;
     uint8_t result;
     int cylinder;
+    int direction;  // of the last seek: 1 towards the inner cylinders, -1 back
     PC80D88 *disk;
 } drive_status_t;
 
@@ -122,12 +131,27 @@ class PD765C {
     uint8_t readStatusRegister(void);
     uint8_t readDataRegister(void);
 
-    void setIRQFlag(bool *irqFlag);
+    void setIRQFlag(bool *irqFlag, PC80SCHEDULER *scheduler);
+
+    void registerIO(PC80IO *io);
 
     int openDrive(int drive, char *fileName);
     int closeDrive(int drive);
 
     void eject(void);
+    void flush(void);
+    void setDiskCache(bool value) { mDiskCache = value; }
+    void setDiskOverlay(bool value) { mDiskOverlay = value; }
+    int commitOverlay(int drive);
+    int discardOverlay(int drive);
+    bool isOverlay(int drive) { return mDrive[drive].disk->isOverlay(); }
+
+    uint32_t getReadAheadHits(void);
+    uint32_t getReadAheadMisses(void);
+
+#ifdef PC80_BENCHMARK
+    uint32_t getTransferred(void) { return mTransferred; }
+#endif
 
    private:
     uint8_t mMainStatus;
@@ -151,9 +175,25 @@ class PD765C {
 
     drive_status_t mDrive[MAX_DRIVE];
 
+    bool mDiskCache;             // open images into PSRAM
+    bool mDiskOverlay;           // open images read-only with an overlay file
+    TaskHandle_t mWriterTask;   // writes dirty tracks back to the SD card
+    volatile bool mFlushNow;    // motor off: write back without waiting
+    static void writerTask(void *arg);
+
+    QueueHandle_t mReadAheadQueue;  // drive << 8 | track
+    void readAhead(int drive, int trackNo);
+    static void readAheadTask(void *arg);
+
     int mExecCmd;
 
     bool *mIRQFlag;
+    PC80SCHEDULER *mScheduler;
+    int mIRQEvent;
+
+#ifdef PC80_BENCHMARK
+    uint32_t mTransferred;  // data bytes moved in execution phase
+#endif
 
     uint8_t mWritePrecompensation;
     uint8_t mVFO;
@@ -190,4 +230,13 @@ class PD765C {
     void senseDeviceStatus(void);
 
     void rasieIRQ(void);
+    static void irqEvent(void *arg);
+
+    static int ioInF8(void *arg, int port);
+    static int ioInFA(void *arg, int port);
+    static int ioInFB(void *arg, int port);
+    static void ioOutF4(void *arg, int port, int value);
+    static void ioOutF7(void *arg, int port, int value);
+    static void ioOutF8(void *arg, int port, int value);
+    static void ioOutFB(void *arg, int port, int value);
 };
\ No newline at end of file
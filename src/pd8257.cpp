@@ -46,6 +46,18 @@ int PD8257::init(PC80VM *vm) {
 
 int PD8257::run(void) { return 0; }
 
+void PD8257::registerIO(PC80IO *io) {
+    io->setOut(0x60, 0x67, ioOutAddress, this, 2);
+    io->setOut(0x61, 0x67, ioOutCount, this, 2);
+    io->setOut(0x68, 0x68, ioOut68, this);
+    io->setIn(0x68, 0x68, ioIn68, this);
+}
+
+void PD8257::ioOutAddress(void *arg, int port, int value) { ((PD8257 *)arg)->dmaAddress((port - 0x60) >> 1, value); }
+void PD8257::ioOutCount(void *arg, int port, int value) { ((PD8257 *)arg)->dmaTerminalCount((port - 0x60) >> 1, value); }
+void PD8257::ioOut68(void *arg, int port, int value) { ((PD8257 *)arg)->dmaCmd(value); }
+int PD8257::ioIn68(void *arg, int port) { return ((PD8257 *)arg)->inPort68(); }
+
 void PD8257::dmaAddress(int channel, uint8_t value) {
     // Serial.printf("DMA channel %d %02x\n", channel, value);
 
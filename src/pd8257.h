@@ -35,7 +35,14 @@ class PD8257 {
     void dmaCmd(uint8_t value);
     uint8_t inPort68(void);
 
+    void registerIO(PC80IO *io);
+
    private:
+    static void ioOutAddress(void *arg, int port, int value);
+    static void ioOutCount(void *arg, int port, int value);
+    static void ioOut68(void *arg, int port, int value);
+    static int ioIn68(void *arg, int port);
+
     PC80VM *mVM;
 
     int mChannelAddress[4];